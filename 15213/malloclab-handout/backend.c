@@ -0,0 +1,79 @@
+/*
+ * backend.c - The allocators linked into mdriver (see backend.h)
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+
+DECLARE_BACKEND()           /* mm.c, as mm.o */
+DECLARE_BACKEND(naive_)     /* mm-naive.c */
+DECLARE_BACKEND(first_)     /* mm.c, one build per fit policy */
+DECLARE_BACKEND(best_)
+DECLARE_BACKEND(bounded_)
+DECLARE_BACKEND(next_)
+DECLARE_BACKEND(mt_)        /* mm.c under a lock (mm-mt.c) */
+DECLARE_BACKEND(prof_)      /* mm.c with -DMM_PROFILE */
+DECLARE_BACKEND(sim_)       /* mm.c with -DMM_SIMULATE */
+DECLARE_BACKEND(meta_)      /* mm.c with -DMETA_BITMAP */
+extern void prof_mm_profile(mm_profile_t *p);
+
+/*
+ * libc malloc. It has its own heap, so mdriver neither bounds its
+ * blocks by the memlib heap nor measures its utilization.
+ */
+static int libc_mm_init(void)
+{
+    return 0;
+}
+
+static void *libc_mm_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+static void libc_mm_free(void *ptr)
+{
+    free(ptr);
+}
+
+static void *libc_mm_realloc(void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+static void libc_mm_checkheap(int verbose __attribute__((unused)))
+{
+}
+
+static void libc_mm_footprint(mm_footprint_t *fp)
+{
+    memset(fp, 0, sizeof(*fp));
+}
+
+/* The first backend is the default */
+const backend_t backends[] = {
+    BACKEND("mm", "mm.c", 1, ),
+    BACKEND("naive", "mm-naive.c", 1, naive_),
+    BACKEND("libc", "libc malloc", 0, libc_),
+    BACKEND("first", "mm.c, first fit", 1, first_),
+    BACKEND("best", "mm.c, best fit", 1, best_),
+    BACKEND("bounded", "mm.c, bounded best fit", 1, bounded_),
+    BACKEND("next", "mm.c, next fit", 1, next_),
+    BACKEND("mt", "mm.c, thread safe", 1, mt_),
+    PROFILED_BACKEND("prof", "mm.c, profiled", 1, prof_),
+    BACKEND("sim", "mm.c, reporting heap accesses", 1, sim_),
+    BACKEND("meta", "mm.c, block bitmaps", 1, meta_),
+};
+const int num_backends = sizeof(backends) / sizeof(backends[0]);
+
+/* find_backend - Return the backend called name, or NULL */
+const backend_t *find_backend(const char *name)
+{
+    int i;
+
+    for (i = 0; i < num_backends; i++)
+        if (!strcmp(backends[i].name, name))
+            return &backends[i];
+    return NULL;
+}
@@ -0,0 +1,56 @@
+/*
+ * backend.h - The allocators linked into mdriver
+ *
+ * Each allocator mdriver can run is a backend: a name and a table of
+ * its entry points. Builds of mm.c and mm-naive.c get distinct entry
+ * point names from -DMM_PREFIX=<p> (see the Makefile), so any number
+ * of them link into one driver; libc malloc is a backend as well.
+ *
+ * To add an allocator, build it with its own prefix, then declare the
+ * prefix and add a BACKEND line to the table in backend.c.
+ */
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include <stddef.h>
+
+#include "mm.h"
+
+typedef struct {
+    const char *name;
+    const char *desc;
+    int memlib;         /* allocates from the memlib heap */
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void (*checkheap)(int verbose);
+    void (*footprint)(mm_footprint_t *fp);
+    void (*profile)(mm_profile_t *p);   /* NULL unless built with MM_PROFILE */
+} backend_t;
+
+/* Declare the entry points of the build with prefix p */
+#define DECLARE_BACKEND(p)                              \
+    extern int p##mm_init(void);                        \
+    extern void *p##mm_malloc(size_t size);             \
+    extern void p##mm_free(void *ptr);                  \
+    extern void *p##mm_realloc(void *ptr, size_t size); \
+    extern void p##mm_checkheap(int verbose);           \
+    extern void p##mm_footprint(mm_footprint_t *fp);
+
+/* A table entry for the build with prefix p */
+#define BACKEND(name, desc, memlib, p)                                  \
+    { name, desc, memlib, p##mm_init, p##mm_malloc, p##mm_free,         \
+      p##mm_realloc, p##mm_checkheap, p##mm_footprint, NULL }
+
+/* A table entry for the build with prefix p and -DMM_PROFILE */
+#define PROFILED_BACKEND(name, desc, memlib, p)                         \
+    { name, desc, memlib, p##mm_init, p##mm_malloc, p##mm_free,         \
+      p##mm_realloc, p##mm_checkheap, p##mm_footprint, p##mm_profile }
+
+extern const backend_t backends[];
+extern const int num_backends;
+
+const backend_t *find_backend(const char *name);
+
+#endif /* __BACKEND_H__ */
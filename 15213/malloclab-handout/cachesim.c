@@ -0,0 +1,209 @@
+/*
+ * cachesim.c - A cache and TLB simulator (see cachesim.h)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cachesim.h"
+
+/* cs_size - Parse a size with an optional K or M suffix; -1 if bad */
+static long cs_size(const char *s, char **end)
+{
+    long v = strtol(s, end, 10);
+
+    if (*end == s || v < 0)
+        return -1;
+    if (**end == 'K' || **end == 'k') {
+        v <<= 10;
+        (*end)++;
+    } else if (**end == 'M' || **end == 'm') {
+        v <<= 20;
+        (*end)++;
+    }
+    return v;
+}
+
+/*
+ * cs_level - Configure c from "size:ways:line" (for the TLB, entries
+ *     times the page size is the size). Returns -1 for a bad spec.
+ */
+static int cs_level(cs_cache_t *c, const char *s, int tlb)
+{
+    long size, ways, line;
+    char *p;
+
+    if ((size = cs_size(s, &p)) < 0 || *p++ != ':' ||
+        (ways = cs_size(p, &p)) < 0 || *p++ != ':' ||
+        (line = cs_size(p, &p)) < 0 || (*p != ',' && *p != '\0'))
+        return -1;
+
+    if (size > 0) {         /* a disabled level needs no ways or line */
+        if (ways == 0 || line == 0 || (line & (line - 1)))
+            return -1;
+        if (tlb)
+            size *= line;
+        if (size % (ways * line) != 0)
+            return -1;
+    }
+
+    free(c->tag);
+    free(c->stamp);
+    memset(c, 0, sizeof(*c));
+    if (size == 0)
+        return 0;
+    c->size = size;
+    c->ways = ways;
+    c->line = line;
+    for (c->shift = 0; (1L << c->shift) < line; c->shift++)
+        ;
+    c->sets = size / (ways * line);
+    c->tag = calloc((size_t)c->sets * ways, sizeof(uint64_t));
+    c->stamp = calloc((size_t)c->sets * ways, sizeof(uint64_t));
+    if (c->tag == NULL || c->stamp == NULL) {
+        fprintf(stderr, "Fatal error.  Malloc returned null in cs_level\n");
+        exit(1);
+    }
+    return 0;
+}
+
+/* cs_parse - Configure the levels named in spec */
+static int cs_parse(cachesim_t *cs, const char *s)
+{
+    cs_cache_t *c;
+    int tlb;
+
+    while (s != NULL && *s != '\0') {
+        tlb = 0;
+        if (!strncmp(s, "l1=", 3))
+            c = &cs->l1;
+        else if (!strncmp(s, "l2=", 3))
+            c = &cs->l2;
+        else if (!strncmp(s, "tlb=", 4)) {
+            c = &cs->tlb;
+            tlb = 1;
+        } else
+            return -1;
+        if (cs_level(c, strchr(s, '=') + 1, tlb) < 0)
+            return -1;
+        if ((s = strchr(s, ',')) != NULL)
+            s++;
+    }
+    return 0;
+}
+
+/*
+ * cs_init - Configure the simulator from a spec such as
+ *     CS_DEFAULT_SPEC; levels left out (or all, if spec is NULL) keep
+ *     their defaults. Returns -1 for a bad spec.
+ */
+int cs_init(cachesim_t *cs, const char *spec)
+{
+    memset(cs, 0, sizeof(*cs));
+    if (cs_parse(cs, CS_DEFAULT_SPEC) < 0)
+        return -1;
+    return cs_parse(cs, spec);
+}
+
+/* cs_free - Free the simulator's tables */
+void cs_free(cachesim_t *cs)
+{
+    free(cs->l1.tag);
+    free(cs->l1.stamp);
+    free(cs->l2.tag);
+    free(cs->l2.stamp);
+    free(cs->tlb.tag);
+    free(cs->tlb.stamp);
+    memset(cs, 0, sizeof(*cs));
+}
+
+/* cs_clear - Empty a cache and zero its counts */
+static void cs_clear(cs_cache_t *c)
+{
+    if (c->size > 0) {
+        memset(c->tag, 0, (size_t)c->sets * c->ways * sizeof(uint64_t));
+        memset(c->stamp, 0, (size_t)c->sets * c->ways * sizeof(uint64_t));
+    }
+    memset(c->accesses, 0, sizeof(c->accesses));
+    memset(c->misses, 0, sizeof(c->misses));
+}
+
+/* cs_reset - Empty the caches and the TLB and zero the counts */
+void cs_reset(cachesim_t *cs)
+{
+    cs_clear(&cs->l1);
+    cs_clear(&cs->l2);
+    cs_clear(&cs->tlb);
+    cs->clock = 0;
+}
+
+/*
+ * cs_lookup - Look up the line (or page) holding addr, filling it in
+ *     place of the least recently used way on a miss. Returns 1 on a
+ *     hit.
+ */
+static int cs_lookup(cs_cache_t *c, uint64_t now, uintptr_t addr, int kind)
+{
+    uint64_t lineno = addr >> c->shift;
+    uint64_t *tag = &c->tag[(lineno % c->sets) * c->ways];
+    uint64_t *stamp = &c->stamp[(lineno % c->sets) * c->ways];
+    int w, victim = 0;
+
+    c->accesses[kind]++;
+    for (w = 0; w < c->ways; w++) {
+        if (tag[w] == lineno + 1) {
+            stamp[w] = now;
+            return 1;
+        }
+        if (stamp[w] < stamp[victim])
+            victim = w;
+    }
+    c->misses[kind]++;
+    tag[victim] = lineno + 1;
+    stamp[victim] = now;
+    return 0;
+}
+
+/*
+ * cs_access - Simulate an access of len bytes at addr: one TLB lookup
+ *     for each page it touches, and one L1 lookup for each line, which
+ *     goes on to the L2 on a miss
+ */
+void cs_access(cachesim_t *cs, uintptr_t addr, size_t len, int kind)
+{
+    uintptr_t a, end = addr + (len > 0 ? len : 1);
+
+    if (cs->tlb.size > 0)
+        for (a = addr >> cs->tlb.shift; a <= (end - 1) >> cs->tlb.shift; a++)
+            cs_lookup(&cs->tlb, ++cs->clock, a << cs->tlb.shift, kind);
+    if (cs->l1.size == 0)
+        return;
+    for (a = addr >> cs->l1.shift; a <= (end - 1) >> cs->l1.shift; a++)
+        if (!cs_lookup(&cs->l1, ++cs->clock, a << cs->l1.shift, kind) &&
+            cs->l2.size > 0)
+            cs_lookup(&cs->l2, cs->clock, a << cs->l1.shift, kind);
+}
+
+/* cs_describe - Describe the configuration in buf */
+void cs_describe(const cachesim_t *cs, char *buf, size_t n)
+{
+    char l1[64], l2[64], tlb[64];
+
+    if (cs->l1.size > 0)
+        snprintf(l1, sizeof(l1), "L1 %luKB %d-way %dB lines",
+                 (unsigned long)(cs->l1.size >> 10), cs->l1.ways, cs->l1.line);
+    else
+        snprintf(l1, sizeof(l1), "no L1");
+    if (cs->l2.size > 0)
+        snprintf(l2, sizeof(l2), "L2 %luKB %d-way",
+                 (unsigned long)(cs->l2.size >> 10), cs->l2.ways);
+    else
+        snprintf(l2, sizeof(l2), "no L2");
+    if (cs->tlb.size > 0)
+        snprintf(tlb, sizeof(tlb), "TLB %lu entries %d-way %dKB pages",
+                 (unsigned long)(cs->tlb.size / cs->tlb.line),
+                 cs->tlb.ways, cs->tlb.line >> 10);
+    else
+        snprintf(tlb, sizeof(tlb), "no TLB");
+    snprintf(buf, n, "%s, %s, %s", l1, l2, tlb);
+}
@@ -0,0 +1,53 @@
+/*
+ * cachesim.h - A cache and TLB simulator
+ *
+ * Models an L1 data cache, an L2 cache behind it and a data TLB, each
+ * set associative with LRU replacement, and counts the accesses and
+ * misses fed to it. Writes allocate like reads and write-backs are
+ * not modelled, so only the misses of the access stream are counted.
+ *
+ * Fed with the heap accesses of an allocator (see mem_access in
+ * memlib.h), it measures the locality of the allocator's layout
+ * deterministically: the same trace gives the same counts on any
+ * machine, unlike the hardware counters.
+ *
+ * Each access is tagged as metadata (headers, footers, links) or
+ * payload, and the counts are kept for the two apart.
+ */
+#ifndef __CACHESIM_H__
+#define __CACHESIM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The default configuration, "size:ways:line" for each cache and
+   "entries:ways:page" for the TLB; a size of 0 disables a level,
+   whatever its ways and line (l2=0:0:0) */
+#define CS_DEFAULT_SPEC "l1=32K:8:64,l2=1M:16:64,tlb=64:4:4K"
+
+enum { CS_META, CS_PAYLOAD, CS_KINDS };
+
+typedef struct {
+    uint64_t size;                  /* capacity in bytes, 0 if disabled */
+    int ways;
+    int line;                       /* line (or page) size in bytes */
+    int sets;
+    int shift;                      /* log2 of line */
+    uint64_t *tag;                  /* sets x ways line numbers + 1, 0 = empty */
+    uint64_t *stamp;                /* time of each way's last use */
+    uint64_t accesses[CS_KINDS];
+    uint64_t misses[CS_KINDS];
+} cs_cache_t;
+
+typedef struct {
+    cs_cache_t l1, l2, tlb;
+    uint64_t clock;                 /* lookups so far, for LRU */
+} cachesim_t;
+
+int cs_init(cachesim_t *cs, const char *spec);
+void cs_free(cachesim_t *cs);
+void cs_reset(cachesim_t *cs);
+void cs_access(cachesim_t *cs, uintptr_t addr, size_t len, int kind);
+void cs_describe(const cachesim_t *cs, char *buf, size_t n);
+
+#endif /* __CACHESIM_H__ */
@@ -6,11 +6,14 @@
  * May not be used, modified, or copied without permission.
  */
 
+#define _GNU_SOURCE             /* RUSAGE_THREAD */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/times.h>
+#include <sys/resource.h>
 #include "clock.h"
 
 
@@ -24,69 +27,70 @@
 
 #if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * x86 time stamp counter
  *******************************************************/
+#include <cpuid.h>
 
+static int has_rdtscp = -1;     /* -1 until tsc_features has run */
+static int has_invariant_tsc = 0;
 
-/* $begin x86cyclecounter */
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+/* Look up the TSC features in cpuid's extended leaves */
+static void tsc_features(void)
+{
+    unsigned eax, ebx, ecx, edx;
 
+    has_rdtscp = 0;
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+        has_rdtscp = (edx >> 27) & 1;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        has_invariant_tsc = (edx >> 8) & 1;
+}
 
-/* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
-void access_counter(unsigned *hi, unsigned *lo)
+/*
+ * cycles_begin - Read the TSC at the start of a measurement. The
+ *     lfence keeps the read from starting before earlier instructions
+ *     complete.
+ */
+static inline unsigned long long cycles_begin(void)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-        : "=r" (*hi), "=r" (*lo)                /* and move results to */
-        : /* No input */                        /* the two outputs */
-        : "%edx", "%eax");
+    unsigned hi, lo;
+
+    asm volatile("lfence; rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+    return ((unsigned long long)hi << 32) | lo;
 }
 
-/* Record the current value of the cycle counter. */
-void start_counter()
+/*
+ * cycles_end - Read the TSC at the end of a measurement. rdtscp waits
+ *     for the code being timed to complete, and the lfence keeps later
+ *     instructions from starting before the read.
+ */
+static inline unsigned long long cycles_end(void)
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    unsigned hi, lo;
+
+    if (has_rdtscp < 0)
+        tsc_features();
+    if (has_rdtscp)
+        asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi) : : "ecx", "memory");
+    else
+        asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) : : "memory");
+    return ((unsigned long long)hi << 32) | lo;
 }
 
-/* Return the number of cycles since the last call to start_counter. */
-double get_counter()
+/* Does the TSC tick at a constant rate, whatever the CPU frequency? */
+int tsc_invariant()
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
-
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
-
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-        fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
-    }
-    return result;
+    if (has_rdtscp < 0)
+        tsc_features();
+    return has_invariant_tsc;
 }
-/* $end x86cyclecounter */
 
 #elif defined(__alpha)
 
 /****************************************************
- * Alpha versions of start_counter() and get_counter()
+ * Alpha cycle counter
  ***************************************************/
 
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
-
-
-/* Use Alpha cycle timer to compute cycles.  Then use
-   measured clock speed to compute seconds 
-*/
-
 /*
  * counterRoutine is an array of Alpha instructions to access 
  * the Alpha's processor cycle counter. It uses the rpcc 
@@ -109,29 +113,20 @@ static unsigned int counterRoutine[] =
 /* Cast the above instructions into a function. */
 static unsigned int (*counter)(void)= (void *)counterRoutine;
 
+static inline unsigned long long cycles_begin(void)
+{
+    return counter();
+}
 
-void start_counter()
+static inline unsigned long long cycles_end(void)
 {
-    /* Get cycle counter */
-    cyc_hi = 0;
-    cyc_lo = counter();
+    return counter();
 }
 
-double get_counter()
+/* The Alpha counter is process time, not a constant-rate clock */
+int tsc_invariant()
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
-    ncyc_lo = counter();
-    ncyc_hi = 0;
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-        fprintf(stderr, "Error: Cycle counter returning negative value: %.0f\n", result);
-    }
-    return result;
+    return 0;
 }
 
 #else
@@ -141,23 +136,25 @@ double get_counter()
  * counter routines. Newer models of sparcs (v8plus) have cycle
  * counters that can be accessed from user programs, but since there
  * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
+ * haven't provided a Sparc version here. The counter then counts
+ * nanoseconds of CLOCK_MONOTONIC_RAW instead.
  ***************************************************************/
 
-void start_counter()
+static unsigned long long clock_ns(void);
+
+static inline unsigned long long cycles_begin(void)
+{
+    return clock_ns();
+}
+
+static inline unsigned long long cycles_end(void)
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return clock_ns();
 }
 
-double get_counter() 
+int tsc_invariant()
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return 0;
 }
 #endif
 
@@ -167,62 +164,153 @@ double get_counter()
 /*******************************
  * Machine-independent functions
  ******************************/
+
+/*
+ * The counter normally counts cycles of the hardware counter above.
+ * After set_counter_clock(1) it counts nanoseconds of
+ * CLOCK_MONOTONIC_RAW instead, for machines whose cycle counter does
+ * not tick at a constant rate; mhz then reports 1000 ticks per usec.
+ */
+static int use_clock = 0;
+static unsigned long long cyc_start = 0;
+
+/* clock_ns - Nanoseconds of CLOCK_MONOTONIC_RAW, which NTP never slews */
+static unsigned long long clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Count clock nanoseconds (1) or hardware cycles (0) */
+void set_counter_clock(int clock)
+{
+    use_clock = clock;
+}
+
+/* Reentrant version of start_counter: the start is kept by the caller */
+unsigned long long counter_start()
+{
+    return use_clock ? clock_ns() : cycles_begin();
+}
+
+/* Reentrant version of get_counter: the ticks since counter_start */
+double counter_since(unsigned long long start)
+{
+    unsigned long long now = use_clock ? clock_ns() : cycles_end();
+
+    return (double)(now - start);
+}
+
+/* Record the current value of the counter. */
+void start_counter()
+{
+    cyc_start = counter_start();
+}
+
+/* Return the number of ticks since the last call to start_counter. */
+double get_counter()
+{
+    return counter_since(cyc_start);
+}
+
+/* Return the raw value of the cycle counter. Cheaper than
+   start_counter/get_counter for timing many short events. */
+unsigned long long read_counter()
+{
+    return cycles_begin();
+}
+
 double ovhd()
 {
     /* Do it twice to eliminate cache effects */
     int i;
     double result;
 
-    for (i = 0; i < 2; i++) {
-        start_counter();
-        result = get_counter();
-    }
+    for (i = 0; i < 2; i++)
+        result = counter_since(counter_start());
     return result;
 }
 
 /* $begin mhz */
-/* Get the clock rate from /proc */
-double mhz_full(int verbose, int sleeptime __attribute__((unused)))
+/*
+ * mhz_full - Determine the rate of the counter, in MHz. The cycle
+ *     counter is timed against CLOCK_MONOTONIC_RAW over sleeptime
+ *     msecs, five times, and the median rate kept. (The "cpu MHz" of
+ *     /proc/cpuinfo is the current core frequency, which on a CPU
+ *     that scales its frequency is not the rate of the TSC.)
+ */
+double mhz_full(int verbose, int sleeptime)
 {
-    static char buf[2048];
-
-    FILE *fp = fopen("/proc/cpuinfo", "r");
-    double mhz = 0.0;
+    double rate[5], t;
+    unsigned long long c0, c1, n0, n1;
+    struct timespec req;
+    int i, j;
+
+    if (use_clock) {
+        if (verbose)
+            printf("Counting nanoseconds of CLOCK_MONOTONIC_RAW\n");
+        return 1000.0;
+    }
 
-    while (fgets(buf, 2048, fp)) {
-        if (strstr(buf, "cpu MHz")) {
-            sscanf(buf, "cpu MHz\t: %lf", &mhz);
-            break;
+    req.tv_sec = sleeptime / 1000;
+    req.tv_nsec = (sleeptime % 1000) * 1000000L;
+    for (i = 0; i < 5; i++) {
+        n0 = clock_ns();
+        c0 = cycles_begin();
+        nanosleep(&req, NULL);
+        n1 = clock_ns();
+        c1 = cycles_end();
+        rate[i] = (double)(c1 - c0) / ((n1 - n0) / 1e3);
+        for (j = i; j > 0 && rate[j-1] > rate[j]; j--) {
+            t = rate[j];
+            rate[j] = rate[j-1];
+            rate[j-1] = t;
         }
     }
-    fclose(fp);
-    if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", mhz);
-    return mhz;
-
-#if 0
-    double rate;
-
-    start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
-    if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", rate);
-    return rate;
-#endif
+    if (verbose)
+        printf("Processor clock rate ~= %.1f MHz\n", rate[2]);
+    return rate[2];
 }
 /* $end mhz */
 
 /* Version using a default sleeptime */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    return mhz_full(verbose, 20);
 }
 
 /** Special counters that compensate for timer interrupt overhead */
 
+/*
+ * The calibration is done once, by whichever thread first needs it;
+ * two threads racing to do it both store a good value.
+ */
 static double cyc_per_tick = 0.0;
 
+/*
+ * thread_ticks - The user time of the calling thread, in clock ticks.
+ *     The ticks of the whole process (times(2)) would charge a thread
+ *     for the ticks of every other thread measuring at the same time.
+ */
+static clock_t thread_ticks(void)
+{
+#ifdef RUSAGE_THREAD
+    long hz = sysconf(_SC_CLK_TCK);
+    struct rusage ru;
+
+    getrusage(RUSAGE_THREAD, &ru);
+    return (clock_t)(ru.ru_utime.tv_sec * hz +
+                     ru.ru_utime.tv_usec * hz / 1000000);
+#else
+    struct tms t;
+
+    times(&t);
+    return t.tms_utime;
+#endif
+}
+
 #define NEVENT 100
 #define THRESHOLD 1000
 #define RECORDTHRESH 3000
@@ -230,26 +318,23 @@ static double cyc_per_tick = 0.0;
 /* Attempt to see how much time is used by timer interrupt */
 static void callibrate(int verbose)
 {
-    double oldt;
-    struct tms t;
+    double oldt, cpt_min = 0.0;
+    unsigned long long start;
     clock_t oldc;
     int e = 0;
 
-    times(&t);
-    oldc = t.tms_utime;
-    start_counter();
-    oldt = get_counter();
+    oldc = thread_ticks();
+    start = counter_start();
+    oldt = counter_since(start);
     while (e <NEVENT) {
-        double newt = get_counter();
+        double newt = counter_since(start);
 
         if (newt-oldt >= THRESHOLD) {
-            clock_t newc;
-            times(&t);
-            newc = t.tms_utime;
+            clock_t newc = thread_ticks();
             if (newc > oldc) {
                 double cpt = (newt-oldt)/(newc-oldc);
-                if ((cyc_per_tick == 0.0 || cyc_per_tick > cpt) && cpt > RECORDTHRESH)
-                    cyc_per_tick = cpt;
+                if ((cpt_min == 0.0 || cpt_min > cpt) && cpt > RECORDTHRESH)
+                    cpt_min = cpt;
                 /*
                   if (verbose)
                   printf("Saw event lasting %.0f cycles and %d ticks.  Ratio = %f\n",
@@ -261,33 +346,39 @@ static void callibrate(int verbose)
             oldt = newt;
         }
     }
+    __atomic_store(&cyc_per_tick, &cpt_min, __ATOMIC_RELAXED);
     if (verbose)
-        printf("Setting cyc_per_tick to %f\n", cyc_per_tick);
+        printf("Setting cyc_per_tick to %f\n", cpt_min);
 }
 
-static clock_t start_tick = 0;
-
-void start_comp_counter() 
+static double get_cyc_per_tick(void)
 {
-    struct tms t;
+    double cpt;
+
+    __atomic_load(&cyc_per_tick, &cpt, __ATOMIC_RELAXED);
+    return cpt;
+}
+
+static comp_counter_t comp_counter;
 
-    if (cyc_per_tick == 0.0)
+/* Reentrant version of start_comp_counter */
+void start_comp_counter_r(comp_counter_t *c)
+{
+    if (get_cyc_per_tick() == 0.0)
         callibrate(0);
-    times(&t);
-    start_tick = t.tms_utime;
-    start_counter();
+    c->tick = thread_ticks();
+    c->start = counter_start();
 }
 
-double get_comp_counter() 
+/* Reentrant version of get_comp_counter */
+double get_comp_counter_r(comp_counter_t *c)
 {
-    double time = get_counter();
+    double time = counter_since(c->start);
     double ctime;
-    struct tms t;
     clock_t ticks;
 
-    times(&t);
-    ticks = t.tms_utime - start_tick;
-    ctime = time - ticks*cyc_per_tick;
+    ticks = thread_ticks() - c->tick;
+    ctime = time - ticks*get_cyc_per_tick();
     /*
       printf("Measured %.0f cycles.  Ticks = %d.  Corrected %.0f cycles\n",
       time, (int) ticks, ctime);
@@ -295,3 +386,12 @@ double get_comp_counter()
     return ctime;
 }
 
+void start_comp_counter() 
+{
+    start_comp_counter_r(&comp_counter);
+}
+
+double get_comp_counter() 
+{
+    return get_comp_counter_r(&comp_counter);
+}
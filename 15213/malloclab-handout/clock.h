@@ -6,17 +6,48 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/*
+ * Reentrant versions of start_counter and get_counter, for timing from
+ * several threads at once: counter_since(s) is the number of ticks
+ * since s = counter_start().
+ */
+unsigned long long counter_start();
+double counter_since(unsigned long long start);
+
+/* Read the raw cycle counter */
+unsigned long long read_counter();
+
 /* Measure overhead for counter */
 double ovhd();
 
 /* Determine clock rate of processor (using a default sleeptime) */
 double mhz(int verbose);
 
-/* Determine clock rate of processor, having more control over accuracy */
+/* Determine clock rate of processor, calibrating over sleeptime msecs */
 double mhz_full(int verbose, int sleeptime);
 
+/* Does the cycle counter tick at a constant rate (x86 invariant TSC)? */
+int tsc_invariant();
+
+/* Count nanoseconds of CLOCK_MONOTONIC_RAW instead of cycles */
+void set_counter_clock(int clock);
+
 /** Special counters that compensate for timer interrupt overhead */
 
 void start_comp_counter();
 
 double get_comp_counter();
+
+/*
+ * Reentrant versions, the start being kept in c. The timer ticks
+ * are counted in the user time of the calling thread, so threads
+ * measuring at once do not subtract each other's ticks.
+ */
+typedef struct {
+    unsigned long long start;
+    long tick;
+} comp_counter_t;
+
+void start_comp_counter_r(comp_counter_t *c);
+
+double get_comp_counter_r(comp_counter_t *c);
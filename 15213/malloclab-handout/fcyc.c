@@ -6,10 +6,16 @@
  *
  * Uses the cycle timer routines in clock.c to estimate the
  * the time in CPU cycles for a function f.
+ *
+ * All of the state of a measurement lives in an fcyc_ctx_t, so threads
+ * with contexts of their own can measure at the same time. The
+ * original interface (fcyc, set_fcyc_*) works on one global context.
  */
 #include <stdlib.h>
+#include <string.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -20,64 +26,93 @@
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
-
-static int kbest = K;
-static int maxsamples = MAXSAMPLES;
-static double epsilon = EPSILON;
-static int compensate = COMPENSATE;
-static int clear_cache = CLEAR_CACHE;
-static int cache_bytes = CACHE_BYTES;
-static int cache_block = CACHE_BLOCK;
+#define CACHE_BYTES 0        /* Bytes swept to clear cache, 0 = 2 x LLC */
+#define CACHE_BLOCK 0        /* Cache block size in bytes, 0 = detected */
+#define CACHE_FALLBACK (1<<25) /* Bytes swept when the LLC is unknown */
+#define WARMUPS 2            /* Runs discarded by fcyc_robust */
+#define SAMPLES 31           /* Samples taken by fcyc_robust */
+#define CONFIDENCE 0.95      /* Confidence level of fcyc_robust */
+#define RESAMPLES 2000       /* Bootstrap resamples */
+#define MAD_CUTOFF 3.5       /* Reject samples this many MADs from median */
 
-static int *cache_buf = NULL;
+/* The context behind the global interface */
+static fcyc_ctx_t global_ctx = {
+    K, MAXSAMPLES, EPSILON, COMPENSATE, CLEAR_CACHE, CACHE_BYTES,
+    CACHE_BLOCK, WARMUPS, SAMPLES, CONFIDENCE, NULL, 0,
+    NULL, 0, NULL, 0, 0
+};
 
-static double *values = NULL;
-static int samplecount = 0;
-
-/* for debugging only */
-#define KEEP_VALS 0
-#define KEEP_SAMPLES 0
+/*
+ * fcyc_ctx_init - Give a context the default parameters
+ */
+void fcyc_ctx_init(fcyc_ctx_t *ctx)
+{
+    ctx->kbest = K;
+    ctx->maxsamples = MAXSAMPLES;
+    ctx->epsilon = EPSILON;
+    ctx->compensate = COMPENSATE;
+    ctx->clear_cache = CLEAR_CACHE;
+    ctx->cache_bytes = CACHE_BYTES;
+    ctx->cache_block = CACHE_BLOCK;
+    ctx->warmups = WARMUPS;
+    ctx->nsamples = SAMPLES;
+    ctx->confidence = CONFIDENCE;
+    ctx->flush_lo = NULL;
+    ctx->flush_len = 0;
+    ctx->cache_buf = NULL;
+    ctx->cache_buf_bytes = 0;
+    ctx->values = NULL;
+    ctx->nvalues = 0;
+    ctx->samplecount = 0;
+}
 
-#if KEEP_SAMPLES
-static double *samples = NULL;
-#endif
+/*
+ * fcyc_ctx_free - Free the buffers of a context
+ */
+void fcyc_ctx_free(fcyc_ctx_t *ctx)
+{
+    free(ctx->cache_buf);
+    free(ctx->values);
+    ctx->cache_buf = NULL;
+    ctx->cache_buf_bytes = 0;
+    ctx->values = NULL;
+    ctx->nvalues = 0;
+}
 
 /* 
  * init_sampler - Start new sampling process 
  */
-static void init_sampler()
+static void init_sampler(fcyc_ctx_t *ctx)
 {
-    if (values)
-	free(values);
-    values = calloc(kbest, sizeof(double));
-#if KEEP_SAMPLES
-    if (samples)
-	free(samples);
-    /* Allocate extra for wraparound analysis */
-    samples = calloc(maxsamples+kbest, sizeof(double));
-#endif
-    samplecount = 0;
+    if (ctx->nvalues < ctx->kbest) {
+	free(ctx->values);
+	ctx->values = calloc(ctx->kbest, sizeof(double));
+	if (!ctx->values) {
+	    fprintf(stderr, "Fatal error.  Malloc returned null in init_sampler\n");
+	    exit(1);
+	}
+	ctx->nvalues = ctx->kbest;
+    }
+    ctx->samplecount = 0;
 }
 
 /* 
  * add_sample - Add new sample  
  */
-static void add_sample(double val)
+static void add_sample(fcyc_ctx_t *ctx, double val)
 {
+    double *values = ctx->values;
+    int kbest = ctx->kbest;
     int pos = 0;
-    if (samplecount < kbest) {
-	pos = samplecount;
+
+    if (ctx->samplecount < kbest) {
+	pos = ctx->samplecount;
 	values[pos] = val;
     } else if (val < values[kbest-1]) {
 	pos = kbest-1;
 	values[pos] = val;
     }
-#if KEEP_SAMPLES
-    samples[samplecount] = val;
-#endif
-    samplecount++;
+    ctx->samplecount++;
     /* Insertion sort */
     while (pos > 0 && values[pos-1] > values[pos]) {
 	double temp = values[pos-1];
@@ -90,81 +125,344 @@ static void add_sample(double val)
 /* 
  * has_converged- Have kbest minimum measurements converged within epsilon? 
  */
-static int has_converged()
+static int has_converged(fcyc_ctx_t *ctx)
 {
     return
-	(samplecount >= kbest) &&
-	((1 + epsilon)*values[0] >= values[kbest-1]);
+	(ctx->samplecount >= ctx->kbest) &&
+	((1 + ctx->epsilon)*ctx->values[0] >= ctx->values[ctx->kbest-1]);
+}
+
+/*
+ * sysfs_cache - Size of the level-level data or unified cache of cpu0,
+ *     and its line size, from sysfs. Returns 0 if there is none.
+ */
+static long sysfs_cache(int level, long *line)
+{
+    char path[128], buf[64];
+    FILE *fp;
+    long bytes = 0;
+    int i, lvl;
+
+    for (i = 0; bytes == 0; i++) {
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    break;
+	if (fscanf(fp, "%d", &lvl) != 1)
+	    lvl = 0;
+	fclose(fp);
+	if (lvl != level)
+	    continue;
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	buf[0] = '\0';
+	if (fgets(buf, sizeof(buf), fp) == NULL || !strncmp(buf, "Instruction", 11)) {
+	    fclose(fp);
+	    continue;
+	}
+	fclose(fp);
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+	if ((fp = fopen(path, "r")) != NULL) {
+	    char unit = 'K';
+	    if (fscanf(fp, "%ld%c", &bytes, &unit) >= 1)
+		bytes <<= (unit == 'M') ? 20 : (unit == 'K') ? 10 : 0;
+	    fclose(fp);
+	}
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu0/cache/index%d/coherency_line_size", i);
+	if ((fp = fopen(path, "r")) != NULL) {
+	    if (fscanf(fp, "%ld", line) != 1)
+		*line = 0;
+	    fclose(fp);
+	}
+    }
+    return bytes;
+}
+
+/*
+ * fcyc_cache_sizes - The sizes of the L1 data, L2 and last-level
+ *     caches and of a cache line, from sysconf or else sysfs. A level
+ *     that cannot be found is 0; the line size defaults to 64.
+ */
+void fcyc_cache_sizes(long *l1d, long *l2, long *llc, long *line)
+{
+    static long sizes[4] = { -1 };
+    long lsize = 0;
+    int level;
+
+    if (sizes[0] < 0) {
+	long v[4] = { 0, 0, 0, 0 };
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+	v[0] = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+	v[1] = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	v[2] = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	v[3] = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+#endif
+	for (level = 1; level <= 3; level++) {
+	    if (v[level-1] <= 0)
+		v[level-1] = sysfs_cache(level, &lsize);
+	    if (v[3] <= 0)
+		v[3] = lsize;
+	}
+	if (v[2] <= 0)    /* no L3: the LLC is the L2 */
+	    v[2] = v[1] > 0 ? v[1] : v[0];
+	if (v[3] <= 0)
+	    v[3] = 64;
+	sizes[1] = v[1] > 0 ? v[1] : 0;
+	sizes[2] = v[2] > 0 ? v[2] : 0;
+	sizes[3] = v[3];
+	sizes[0] = v[0] > 0 ? v[0] : 0;
+    }
+    if (l1d)
+	*l1d = sizes[0];
+    if (l2)
+	*l2 = sizes[1];
+    if (llc)
+	*llc = sizes[2];
+    if (line)
+	*line = sizes[3];
+}
+
+/*
+ * fcyc_flush - Evict the lines of [lo, lo+len) from every cache level
+ *     with clflush. Returns 0 where there is no such instruction.
+ */
+int fcyc_flush(const void *lo, size_t len)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    const char *p = (const char *)lo, *end = p + len;
+    long line;
+
+    fcyc_cache_sizes(NULL, NULL, NULL, &line);
+    p -= (unsigned long)p % line;
+    for (; p < end; p += line)
+	asm volatile("clflush %0" : : "m" (*(volatile const char *)p));
+    asm volatile("mfence" : : : "memory");
+    return 1;
+#else
+    (void)lo;
+    (void)len;
+    return 0;
+#endif
 }
 
 /* 
- * clear - Code to clear cache 
+ * clear - Code to clear cache: read through a buffer of cache_bytes
+ *     (twice the last-level cache unless set), then clflush the range
+ *     to flush. The buffer is written when it is allocated, so that it
+ *     is backed by real pages rather than the shared zero page.
  */
-static volatile int sink = 0;
+static __thread volatile int sink = 0;
 
-static void clear()
+static void clear(fcyc_ctx_t *ctx)
 {
     int x = sink;
     int *cptr, *cend;
-    int incr = cache_block/sizeof(int);
-    if (!cache_buf) {
-	cache_buf = malloc(cache_bytes);
-	if (!cache_buf) {
+    long llc, line;
+    int bytes = ctx->cache_bytes, incr = ctx->cache_block/sizeof(int);
+
+    fcyc_cache_sizes(NULL, NULL, &llc, &line);
+    if (bytes <= 0)
+	bytes = llc > 0 ? 2 * llc : CACHE_FALLBACK;
+    if (incr <= 0)
+	incr = line/sizeof(int);
+    if (ctx->cache_buf_bytes != bytes) {
+	free(ctx->cache_buf);
+	ctx->cache_buf = malloc(bytes);
+	if (!ctx->cache_buf) {
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	memset(ctx->cache_buf, 1, bytes);
+	ctx->cache_buf_bytes = bytes;
     }
-    cptr = (int *) cache_buf;
-    cend = cptr + cache_bytes/sizeof(int);
+    cptr = (int *) ctx->cache_buf;
+    cend = cptr + bytes/sizeof(int);
     while (cptr < cend) {
 	x += *cptr;
 	cptr += incr;
     }
     sink = x;
+    if (ctx->flush_len > 0)
+	fcyc_flush(ctx->flush_lo, ctx->flush_len);
 }
 
 /*
- * fcyc - Use K-best scheme to estimate the running time of function f
+ * sample - Time one run of f
  */
-double fcyc(test_funct f, void *argp)
+static double sample(fcyc_ctx_t *ctx, test_funct f, void *argp)
 {
-    double result;
-    init_sampler();
-    if (compensate) {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_comp_counter();
-	    f(argp);
-	    cyc = get_comp_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
+    if (ctx->clear_cache)
+	clear(ctx);
+    if (ctx->compensate) {
+	comp_counter_t c;
+	start_comp_counter_r(&c);
+	f(argp);
+	return get_comp_counter_r(&c);
     } else {
-	do {
-	    double cyc;
-	    if (clear_cache)
-		clear();
-	    start_counter();
-	    f(argp);
-	    cyc = get_counter();
-	    add_sample(cyc);
-	} while (!has_converged() && samplecount < maxsamples);
+	unsigned long long start = counter_start();
+	f(argp);
+	return counter_since(start);
     }
+}
+
+/*
+ * fcyc_r - Use K-best scheme to estimate the running time of function f
+ */
+double fcyc_r(fcyc_ctx_t *ctx, test_funct f, void *argp)
+{
+    init_sampler(ctx);
+    do {
+	add_sample(ctx, sample(ctx, f, argp));
+    } while (!has_converged(ctx) && ctx->samplecount < ctx->maxsamples);
 #ifdef DEBUG
     {
 	int i;
-	printf(" %d smallest values: [", kbest);
-	for (i = 0; i < kbest; i++)
-	    printf("%.0f%s", values[i], i==kbest-1 ? "]\n" : ", ");
+	printf(" %d smallest values: [", ctx->kbest);
+	for (i = 0; i < ctx->kbest; i++)
+	    printf("%.0f%s", ctx->values[i], i==ctx->kbest-1 ? "]\n" : ", ");
     }
 #endif
-    result = values[0];
-#if !KEEP_VALS
-    free(values); 
-    values = NULL;
-#endif
-    return result;  
+    return ctx->values[0];
+}
+
+double fcyc(test_funct f, void *argp)
+{
+    return fcyc_r(&global_ctx, f, argp);
+}
+
+/*
+ * cmp_double - qsort comparison of doubles
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * median - Median of the n sorted values in v
+ */
+static double median(const double *v, int n)
+{
+    return (n % 2) ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2;
+}
+
+/*
+ * fcyc_summarize - Reject outliers, then find the median and its
+ *     bootstrap confidence interval. A sample is an outlier when it
+ *     lies more than MAD_CUTOFF scaled median absolute deviations from
+ *     the median; unlike a mean and standard deviation, neither is
+ *     moved by the outliers themselves (a timer interrupt or page
+ *     fault during one run, say). The interval is the percentile
+ *     bootstrap: the median of many resamples (with replacement) of
+ *     the kept samples, cut at the tails. The resamples are drawn from
+ *     a fixed seed, so the same samples give the same interval.
+ *
+ *     A coarse timer makes many samples equal, and the MAD can then be
+ *     0. The MAD is floored at the timer's resolution, as far as the
+ *     samples show it (their smallest nonzero difference), so a sample
+ *     is never rejected for being one tick off; when every sample is
+ *     equal none is rejected. The interval is widened by half that
+ *     resolution, since the median cannot be known any closer.
+ */
+void fcyc_summarize_r(fcyc_ctx_t *ctx, double *v, int n, fcyc_stats_t *st)
+{
+    double *dev, *boot, *resample, m, mad, res;
+    unsigned long long rng = 0x9e3779b97f4a7c15ULL;
+    int i, j, kept, lo, hi;
+
+    st->samples = n;
+    st->kept = 0;
+    st->median = st->lo = st->hi = 0;
+    if (n <= 0)
+	return;
+
+    dev = malloc(n * sizeof(double));
+    resample = malloc(n * sizeof(double));
+    boot = malloc(RESAMPLES * sizeof(double));
+    if (!dev || !resample || !boot) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in fcyc_summarize\n");
+	exit(1);
+    }
+
+    /* Drop the outliers; 1.4826 scales the MAD to a standard deviation */
+    qsort(v, n, sizeof(double), cmp_double);
+    m = median(v, n);
+    for (i = 0; i < n; i++)
+	dev[i] = v[i] > m ? v[i] - m : m - v[i];
+    qsort(dev, n, sizeof(double), cmp_double);
+    mad = 1.4826 * median(dev, n);
+    for (i = 1, res = 0; i < n; i++)
+	if (v[i] > v[i-1] && (res == 0 || v[i] - v[i-1] < res))
+	    res = v[i] - v[i-1];
+    if (mad < res)
+	mad = res;
+    for (i = kept = 0; i < n; i++)
+	if (mad == 0 ||
+	    (v[i] - m <= MAD_CUTOFF * mad && m - v[i] <= MAD_CUTOFF * mad))
+	    v[kept++] = v[i];
+
+    /* Bootstrap the median of what is left */
+    for (j = 0; j < RESAMPLES; j++) {
+	for (i = 0; i < kept; i++) {
+	    rng ^= rng >> 12;
+	    rng ^= rng << 25;
+	    rng ^= rng >> 27;
+	    resample[i] = v[(rng * 0x2545f4914f6cdd1dULL >> 33) % kept];
+	}
+	qsort(resample, kept, sizeof(double), cmp_double);
+	boot[j] = median(resample, kept);
+    }
+    qsort(boot, RESAMPLES, sizeof(double), cmp_double);
+    lo = (int)((1 - ctx->confidence) / 2 * RESAMPLES);
+    hi = RESAMPLES - 1 - lo;
+
+    st->kept = kept;
+    st->median = median(v, kept);
+    st->lo = boot[lo] - res / 2;
+    st->hi = boot[hi] + res / 2;
+
+    free(dev);
+    free(resample);
+    free(boot);
+}
+
+void fcyc_summarize(double *v, int n, fcyc_stats_t *st)
+{
+    fcyc_summarize_r(&global_ctx, v, n, st);
+}
+
+/*
+ * fcyc_robust_r - Estimate the running time of f from the median of
+ *     nsamples samples, after warmups discarded runs
+ */
+double fcyc_robust_r(fcyc_ctx_t *ctx, test_funct f, void *argp,
+		     fcyc_stats_t *st)
+{
+    double *v;
+    int i;
+
+    if ((v = malloc(ctx->nsamples * sizeof(double))) == NULL) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in fcyc_robust\n");
+	exit(1);
+    }
+    for (i = -ctx->warmups; i < ctx->nsamples; i++) {
+	double cyc = sample(ctx, f, argp);
+	if (i >= 0)
+	    v[i] = cyc;
+    }
+    fcyc_summarize_r(ctx, v, ctx->nsamples, st);
+    free(v);
+    return st->median;
+}
+
+double fcyc_robust(test_funct f, void *argp, fcyc_stats_t *st)
+{
+    return fcyc_robust_r(&global_ctx, f, argp, st);
 }
 
 
@@ -179,30 +477,35 @@ double fcyc(test_funct f, void *argp)
  */
 void set_fcyc_clear_cache(int clear)
 {
-    clear_cache = clear;
+    global_ctx.clear_cache = clear;
 }
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = 0 (twice the last-level cache)
  */
 void set_fcyc_cache_size(int bytes)
 {
-    if (bytes != cache_bytes) {
-	cache_bytes = bytes;
-	if (cache_buf) {
-	    free(cache_buf);
-	    cache_buf = NULL;
-	}
-    }
+    global_ctx.cache_bytes = bytes;
 }
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 0 (the detected line size)
  */
 void set_fcyc_cache_block(int bytes) {
-    cache_block = bytes;
+    global_ctx.cache_block = bytes;
+}
+
+/*
+ * set_fcyc_flush_range - Memory that clearing the cache also evicts
+ *     with clflush, such as the heap under test
+ *     Default = none
+ */
+void set_fcyc_flush_range(const void *lo, size_t len)
+{
+    global_ctx.flush_lo = lo;
+    global_ctx.flush_len = len;
 }
 
 
@@ -213,7 +516,7 @@ void set_fcyc_cache_block(int bytes) {
  */
 void set_fcyc_compensate(int compensate_arg)
 {
-    compensate = compensate_arg;
+    global_ctx.compensate = compensate_arg;
 }
 
 /* 
@@ -222,7 +525,7 @@ void set_fcyc_compensate(int compensate_arg)
  */
 void set_fcyc_k(int k)
 {
-    kbest = k;
+    global_ctx.kbest = k;
 }
 
 /* 
@@ -233,7 +536,7 @@ void set_fcyc_k(int k)
  */
 void set_fcyc_maxsamples(int maxsamples_arg)
 {
-    maxsamples = maxsamples_arg;
+    global_ctx.maxsamples = maxsamples_arg;
 }
 
 /* 
@@ -242,10 +545,32 @@ void set_fcyc_maxsamples(int maxsamples_arg)
  */
 void set_fcyc_epsilon(double epsilon_arg)
 {
-    epsilon = epsilon_arg;
+    global_ctx.epsilon = epsilon_arg;
 }
 
+/*
+ * set_fcyc_warmups - Runs discarded before fcyc_robust samples
+ *     Default = 2
+ */
+void set_fcyc_warmups(int warmups_arg)
+{
+    global_ctx.warmups = warmups_arg;
+}
 
+/*
+ * set_fcyc_samples - Number of samples taken by fcyc_robust
+ *     Default = 31
+ */
+void set_fcyc_samples(int samples_arg)
+{
+    global_ctx.nsamples = samples_arg;
+}
 
-
-
+/*
+ * set_fcyc_confidence - Confidence level of fcyc_robust's interval
+ *     Default = 0.95
+ */
+void set_fcyc_confidence(double confidence_arg)
+{
+    global_ctx.confidence = confidence_arg;
+}
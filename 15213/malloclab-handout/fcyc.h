@@ -7,12 +7,90 @@
  *
  */
 
+#include <stddef.h>
+
 /* The test function takes a generic pointer as input */
 typedef void (*test_funct)(void *);
 
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* The summary of a robust measurement */
+typedef struct {
+    int samples;     /* samples taken, not counting warmups */
+    int kept;        /* samples left after rejecting outliers */
+    double median;   /* median of the kept samples */
+    double lo, hi;   /* confidence interval of the median */
+} fcyc_stats_t;
+
+/*
+ * fcyc_robust - Estimate the cycles used by f from the median of
+ *     many samples rather than the K-best. Runs some warmups, takes a
+ *     fixed number of samples, drops the outliers, and bootstraps a
+ *     confidence interval for the median. Returns the median.
+ */
+double fcyc_robust(test_funct f, void *argp, fcyc_stats_t *st);
+
+/*
+ * fcyc_summarize - The statistics of fcyc_robust, for n samples
+ *     measured some other way. Reorders v.
+ */
+void fcyc_summarize(double *v, int n, fcyc_stats_t *st);
+
+/*
+ * A measurement context: the parameters (see the set_fcyc_* functions
+ * below for their meanings and defaults) and the buffers of one
+ * measurement. Threads measuring at once each use a context of their
+ * own; fcyc and the other functions without the _r suffix use a
+ * global context, which the set_fcyc_* functions configure.
+ */
+typedef struct {
+    int kbest;
+    int maxsamples;
+    double epsilon;
+    int compensate;
+    int clear_cache;
+    int cache_bytes;
+    int cache_block;
+    int warmups;
+    int nsamples;
+    double confidence;
+    const void *flush_lo;   /* clflushed by clear_cache */
+    size_t flush_len;
+
+    /* private */
+    int *cache_buf;
+    int cache_buf_bytes;
+    double *values;
+    int nvalues;
+    int samplecount;
+} fcyc_ctx_t;
+
+/* fcyc_ctx_init - Give a context the default parameters */
+void fcyc_ctx_init(fcyc_ctx_t *ctx);
+
+/* fcyc_ctx_free - Free the buffers of a context */
+void fcyc_ctx_free(fcyc_ctx_t *ctx);
+
+/* The reentrant versions of fcyc, fcyc_robust and fcyc_summarize */
+double fcyc_r(fcyc_ctx_t *ctx, test_funct f, void *argp);
+double fcyc_robust_r(fcyc_ctx_t *ctx, test_funct f, void *argp,
+                     fcyc_stats_t *st);
+void fcyc_summarize_r(fcyc_ctx_t *ctx, double *v, int n, fcyc_stats_t *st);
+
+/*
+ * fcyc_cache_sizes - The sizes in bytes of the L1 data, L2 and
+ *     last-level caches and of a cache line, from sysconf or sysfs.
+ *     Any pointer may be NULL.
+ */
+void fcyc_cache_sizes(long *l1d, long *l2, long *llc, long *line);
+
+/*
+ * fcyc_flush - Evict [lo, lo+len) from the caches with clflush.
+ *     Returns 0 if the machine has no such instruction.
+ */
+int fcyc_flush(const void *lo, size_t len);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -26,16 +104,23 @@ void set_fcyc_clear_cache(int clear);
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = 0 (twice the last-level cache)
  */
 void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 0 (the detected line size)
  */
 void set_fcyc_cache_block(int bytes);
 
+/*
+ * set_fcyc_flush_range - Memory that clearing the cache also evicts
+ *     with clflush, such as the heap under test
+ *     Default = none
+ */
+void set_fcyc_flush_range(const void *lo, size_t len);
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -63,6 +148,20 @@ void set_fcyc_maxsamples(int maxsamples_arg);
  */
 void set_fcyc_epsilon(double epsilon_arg);
 
+/*
+ * set_fcyc_warmups - Runs discarded before fcyc_robust samples
+ *     Default = 2
+ */
+void set_fcyc_warmups(int warmups_arg);
 
+/*
+ * set_fcyc_samples - Number of samples taken by fcyc_robust
+ *     Default = 31
+ */
+void set_fcyc_samples(int samples_arg);
 
-
+/*
+ * set_fcyc_confidence - Confidence level of fcyc_robust's interval
+ *     Default = 0.95
+ */
+void set_fcyc_confidence(double confidence_arg);
@@ -2,41 +2,105 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
 
-static double Mhz;  /* estimated CPU clock frequency */
+static double Mhz;  /* estimated rate of the counter */
+static int robust_warmups = 2;  /* set by set_fsecs_robust */
+static int robust_samples = 31;
 
 extern int verbose; /* -v option in mdriver.c */
 
+/* The timers, the default being chosen in config.h */
+enum { TIMER_TSC, TIMER_CLOCK, TIMER_ITIMER, TIMER_GETTOD, TIMER_AUTO };
+static const char *timer_names[] = { "tsc", "clock", "itimer", "gettod" };
+static int timer = TIMER_AUTO;
+
 /*
- * init_fsecs - initialize the timing package
+ * set_fsecs_timer - Choose the timer by name, before init_fsecs:
+ *     tsc (cycle counter, K-best), clock (CLOCK_MONOTONIC_RAW, K-best),
+ *     itimer or gettod. Returns -1 for an unknown name.
+ */
+int set_fsecs_timer(const char *name)
+{
+    int t;
+
+    for (t = 0; t < TIMER_AUTO; t++) {
+        if (!strcmp(name, timer_names[t])) {
+            timer = t;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* fsecs_timer - The name of the timer in use */
+const char *fsecs_timer(void)
+{
+    return timer == TIMER_AUTO ? "auto" : timer_names[timer];
+}
+
+/*
+ * init_fsecs - initialize the timing package. Unless a timer was
+ *     chosen, the config.h default is used, except that the cycle
+ *     counter gives way to CLOCK_MONOTONIC_RAW when it does not tick
+ *     at a constant rate.
+ *
+ *     Timer-tick compensation is off: the kernel no longer charges
+ *     user time a tick per timer interrupt, so the ticks a run is
+ *     charged say nothing about the interrupts it took, and since
+ *     compensation only ever lowers a sample, the K-best minimum
+ *     picks out the samples it lowered most.
  */
 void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
 
+    if (timer == TIMER_AUTO) {
 #if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
-
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
+        timer = tsc_invariant() ? TIMER_TSC : TIMER_CLOCK;
+#elif USE_CLOCK
+        timer = TIMER_CLOCK;
 #elif USE_ITIMER
-    if (verbose)
-	printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-    if (verbose)
-	printf("Measuring performance with gettimeofday().\n");
+        timer = TIMER_ITIMER;
+#else
+        timer = TIMER_GETTOD;
 #endif
+    } else if (timer == TIMER_TSC && !tsc_invariant()) {
+        fprintf(stderr, "Warning: the cycle counter is not invariant; "
+                "times will vary with the CPU frequency\n");
+    }
+
+    switch (timer) {
+    case TIMER_TSC:
+    case TIMER_CLOCK:
+        if (verbose)
+            printf("Measuring performance with %s.\n", timer == TIMER_TSC ?
+                   "a cycle counter" : "CLOCK_MONOTONIC_RAW");
+
+        /* set key parameters for the fcyc package */
+        set_counter_clock(timer == TIMER_CLOCK);
+        set_fcyc_maxsamples(20);
+        set_fcyc_clear_cache(0);        /* warm; see set_fsecs_cold */
+        set_fcyc_compensate(0);
+        set_fcyc_epsilon(0.01);
+        set_fcyc_k(3);
+        Mhz = mhz(verbose > 0);
+        break;
+    case TIMER_ITIMER:
+        if (verbose)
+            printf("Measuring performance with the interval timer.\n");
+        break;
+    default:
+        if (verbose)
+            printf("Measuring performance with gettimeofday().\n");
+        break;
+    }
 }
 
 /*
@@ -44,14 +108,85 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
-#endif 
+    switch (timer) {
+    case TIMER_TSC:
+    case TIMER_CLOCK:
+        return fcyc(f, argp)/(Mhz*1e6);
+    case TIMER_ITIMER:
+        return ftimer_itimer(f, argp, 10);
+    default:
+        return ftimer_gettod(f, argp, 10);
+    }
 }
 
+/*
+ * fsecs_mhz - The rate of the counter fcyc counts in, in MHz, or 0 if
+ *     the timer in use is not a counter (itimer, gettod)
+ */
+double fsecs_mhz(void)
+{
+    return (timer == TIMER_TSC || timer == TIMER_CLOCK) ? Mhz : 0;
+}
+
+/*
+ * set_fsecs_cold - Time from cold caches (cold != 0) or warm ones, the
+ *     default. Cold caches are cleared before every run by sweeping
+ *     a buffer twice the size of the last-level cache and clflushing
+ *     [lo, lo+len). Only the tsc and clock timers clear the caches;
+ *     returns -1 with the others.
+ */
+int set_fsecs_cold(int cold, const void *lo, size_t len)
+{
+    if (timer != TIMER_TSC && timer != TIMER_CLOCK)
+        return cold ? -1 : 0;
+    set_fcyc_clear_cache(cold);
+    set_fcyc_flush_range(cold ? lo : NULL, cold ? len : 0);
+    return 0;
+}
+
+/*
+ * set_fsecs_robust - Set the warmup runs and samples of fsecs_robust
+ */
+void set_fsecs_robust(int warmups, int samples)
+{
+    robust_warmups = warmups;
+    robust_samples = samples;
+    set_fcyc_warmups(warmups);
+    set_fcyc_samples(samples);
+}
+
+/*
+ * fsecs_robust - Return the median running time of a function f (in
+ *     seconds) over several samples, with outliers rejected and a
+ *     confidence interval in st (see fcyc_robust)
+ */
+double fsecs_robust(fsecs_test_funct f, void *argp, fsecs_stats_t *st)
+{
+    fcyc_stats_t cs;
+    double scale = 1, *v;
+    int i;
 
+    if (timer == TIMER_TSC || timer == TIMER_CLOCK) {
+        scale = 1 / (Mhz*1e6);
+        fcyc_robust(f, argp, &cs);
+    } else {
+        if ((v = malloc(robust_samples * sizeof(double))) == NULL) {
+            fprintf(stderr, "Fatal error.  Malloc returned null in fsecs_robust\n");
+            exit(1);
+        }
+        for (i = -robust_warmups; i < robust_samples; i++) {
+            double secs = (timer == TIMER_ITIMER) ?
+                ftimer_itimer(f, argp, 1) : ftimer_gettod(f, argp, 1);
+            if (i >= 0)
+                v[i] = secs;
+        }
+        fcyc_summarize(v, robust_samples, &cs);
+        free(v);
+    }
+    st->samples = cs.samples;
+    st->kept = cs.kept;
+    st->secs = cs.median * scale;
+    st->lo = cs.lo * scale;
+    st->hi = cs.hi * scale;
+    return st->secs;
+}
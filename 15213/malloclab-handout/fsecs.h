@@ -1,4 +1,21 @@
+#include <stddef.h>
+
 typedef void (*fsecs_test_funct)(void *);
 
+int set_fsecs_timer(const char *name);
+const char *fsecs_timer(void);
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+double fsecs_mhz(void);
+int set_fsecs_cold(int cold, const void *lo, size_t len);
+
+/* The summary of a robust measurement, in seconds */
+typedef struct {
+    int samples;     /* samples taken, not counting warmups */
+    int kept;        /* samples left after rejecting outliers */
+    double secs;     /* median running time */
+    double lo, hi;   /* its 95% confidence interval */
+} fsecs_stats_t;
+
+void set_fsecs_robust(int warmups, int samples);
+double fsecs_robust(fsecs_test_funct f, void *argp, fsecs_stats_t *st);
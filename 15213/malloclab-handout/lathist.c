@@ -0,0 +1,53 @@
+/*
+ * lathist.c - Latency histograms (see lathist.h)
+ */
+#include <string.h>
+
+#include "lathist.h"
+
+/* lh_reset - Empty the histogram */
+void lh_reset(lathist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/* lh_upper - Return the largest value that bucket b counts */
+static uint64_t lh_upper(int b)
+{
+    int shift;
+    uint64_t m;
+
+    if (b < LH_SUB)
+        return b;
+    shift = (b - LH_SUB) / LH_HALF + 1;
+    m = (b - LH_SUB) % LH_HALF + LH_HALF;
+    return ((m + 1) << shift) - 1;
+}
+
+/*
+ * lh_percentile - Return the value below or at which p percent of the
+ *     recorded values lie, to within the bucket resolution. The bound
+ *     is never reported above the largest value actually recorded.
+ *     Returns 0 for an empty histogram.
+ */
+uint64_t lh_percentile(const lathist_t *h, double p)
+{
+    uint64_t want, seen = 0;
+    double rank;
+    int b;
+
+    if (h->total == 0)
+        return 0;
+    /* nearest rank: the smallest count covering p percent */
+    rank = p / 100.0 * h->total;
+    want = (uint64_t)rank;
+    if (want < rank || want == 0)
+        want++;
+
+    for (b = 0; b < LH_BUCKETS; b++) {
+        seen += h->count[b];
+        if (seen >= want)
+            return lh_upper(b) < h->max ? lh_upper(b) : h->max;
+    }
+    return h->max;
+}
@@ -0,0 +1,54 @@
+/*
+ * lathist.h - Latency histograms
+ *
+ * An HDR-style log-linear histogram of 64-bit values (cycles, here).
+ * Values below LH_SUB are counted exactly; above that, every power of
+ * two is split into LH_SUB/2 equal buckets, each 1/(LH_SUB/2) of the
+ * power of two wide. A percentile is reported as the upper bound of
+ * its bucket, so it is never low, and high by less than 1/(LH_SUB/2)
+ * of the value (6.25%) whatever its magnitude.
+ * The largest value is also kept exactly.
+ *
+ * Recording is a few instructions and never allocates, so it can sit
+ * around every call of a trace replay.
+ */
+#ifndef __LATHIST_H__
+#define __LATHIST_H__
+
+#include <stdint.h>
+
+#define LH_SUB_BITS 5
+#define LH_SUB      (1 << LH_SUB_BITS)         /* exact values below this */
+#define LH_HALF     (LH_SUB / 2)
+#define LH_BUCKETS  (LH_SUB + (64 - LH_SUB_BITS) * LH_HALF)
+
+typedef struct {
+    uint64_t count[LH_BUCKETS];
+    uint64_t total;         /* values recorded */
+    uint64_t max;           /* largest value recorded */
+} lathist_t;
+
+/* lh_bucket - Return the bucket that counts value v */
+static inline int lh_bucket(uint64_t v)
+{
+    int shift;
+
+    if (v < LH_SUB)
+        return (int)v;
+    shift = (63 - __builtin_clzll(v)) - (LH_SUB_BITS - 1);
+    return LH_SUB + (shift - 1) * LH_HALF + (int)((v >> shift) - LH_HALF);
+}
+
+/* lh_record - Count value v in h */
+static inline void lh_record(lathist_t *h, uint64_t v)
+{
+    h->count[lh_bucket(v)]++;
+    h->total++;
+    if (v > h->max)
+        h->max = v;
+}
+
+void lh_reset(lathist_t *h);
+uint64_t lh_percentile(const lathist_t *h, double p);
+
+#endif /* __LATHIST_H__ */
@@ -0,0 +1,497 @@
+/*
+ * mbench.c - Allocator microbenchmarks
+ *
+ * Trace replay in mdriver only reports aggregate ops/sec. This driver
+ * runs small canonical kernels instead and reports ns per operation
+ * and allocations per second for each:
+ *
+ *   pairs     malloc/free pairs of one fixed size
+ *   lifo      n blocks allocated, then freed in reverse order
+ *   fifo      n blocks allocated, then freed in allocation order
+ *   random    n blocks allocated, then freed in random order
+ *   realloc   interleaved chains of blocks grown by realloc
+ *   larson    threads replacing random blocks in a slot array, with
+ *             the arrays handed to other threads between rounds
+ *   prodcons  one thread allocates, another frees
+ *
+ * The same source is built against mm.c (mbench-mm), mm-naive.c
+ * (mbench-naive) and the libc malloc (mbench-libc, -DMBENCH_LIBC).
+ * The mm packages are not thread safe, so the threaded kernels hold a
+ * lock around each of their calls unless built against libc.
+ * A single-thread kernel that runs the simulated heap out of memory
+ * (mm-naive never reuses a block) is reported as such and skipped.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fsecs.h"
+
+#ifdef MBENCH_LIBC
+#define MB_NAME          "libc"
+#define MB_THREAD_SAFE   1
+#define mb_malloc(size)  malloc(size)
+#define mb_free(p)       free(p)
+#define mb_realloc(p, s) realloc(p, s)
+#else
+#include "mm.h"
+#include "memlib.h"
+#ifndef MB_NAME
+#define MB_NAME          "mm"
+#endif
+#define MB_THREAD_SAFE   0
+#define mb_malloc(size)  mm_malloc(size)
+#define mb_free(p)       mm_free(p)
+#define mb_realloc(p, s) mm_realloc(p, s)
+#endif
+
+/* fsecs.c reads mdriver's verbosity flag */
+int verbose = 0;
+
+/* Default kernel parameters */
+#define NOPS      100000   /* operations per kernel run */
+#define NBLOCKS   4096     /* live blocks in the free-order kernels */
+#define NCHAINS   16       /* interleaved realloc chains */
+#define MAXGROW   (1<<16)  /* realloc chains grow up to this size */
+#define NSLOTS    1024     /* slots per thread in larson */
+#define NROUNDS   4        /* larson rounds */
+#define QUEUE_LEN 256      /* prodcons queue capacity */
+
+static int nops = NOPS;
+static int nthreads = 2;
+
+/* Describes one kernel run; filled in by the kernel */
+typedef struct {
+    size_t size;    /* block size for fixed-size kernels */
+    double ops;     /* malloc + free + realloc calls per run */
+    double allocs;  /* malloc + realloc calls per run */
+} kparams_t;
+
+static void **blocks;   /* scratch array for the free-order kernels */
+
+/*
+ * Random numbers: a small xorshift so every backend sees the same
+ * sequence and the generator costs next to nothing
+ */
+static unsigned int rand_next(unsigned int *state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/*
+ * reset_heap - start every timed run with an empty heap
+ */
+static void reset_heap(void)
+{
+#ifndef MBENCH_LIBC
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+#endif
+}
+
+/*
+ * xmalloc - malloc for the single-thread kernels. An allocator that
+ *     runs out of heap (mm-naive never reuses memory) abandons the
+ *     kernel rather than the whole run.
+ */
+static jmp_buf oom_jmpbuf;
+
+static void *xmalloc(size_t size)
+{
+    void *p = mb_malloc(size);
+    if (p == NULL)
+        longjmp(oom_jmpbuf, 1);
+    *(char *)p = 1;   /* touch it, as a real caller would */
+    return p;
+}
+
+/*
+ * Locked entry points for the threaded kernels. tmalloc returns NULL
+ * when the heap runs out; a thread that sees it returns THREAD_OOM,
+ * and the kernel abandons itself through oom_jmpbuf once it has joined
+ * its threads.
+ */
+#define THREAD_OOM ((void *)1)
+
+static pthread_mutex_t mb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *tmalloc(size_t size)
+{
+    void *p;
+    if (!MB_THREAD_SAFE)
+        pthread_mutex_lock(&mb_lock);
+    p = mb_malloc(size);
+    if (!MB_THREAD_SAFE)
+        pthread_mutex_unlock(&mb_lock);
+    if (p != NULL)
+        *(char *)p = 1;
+    return p;
+}
+
+static void tfree(void *p)
+{
+    if (!MB_THREAD_SAFE)
+        pthread_mutex_lock(&mb_lock);
+    mb_free(p);
+    if (!MB_THREAD_SAFE)
+        pthread_mutex_unlock(&mb_lock);
+}
+
+/***********************
+ * Single-thread kernels
+ ***********************/
+
+static void k_pairs(void *argp)
+{
+    kparams_t *k = argp;
+    int i;
+
+    reset_heap();
+    for (i = 0; i < nops / 2; i++)
+        mb_free(xmalloc(k->size));
+    k->ops = 2.0 * (nops / 2);
+    k->allocs = nops / 2;
+}
+
+/* Allocate NBLOCKS blocks, then free them in the order of blocks[] */
+static void fill_blocks(size_t size)
+{
+    int i;
+    for (i = 0; i < NBLOCKS; i++)
+        blocks[i] = xmalloc(size);
+}
+
+static void k_lifo(void *argp)
+{
+    kparams_t *k = argp;
+    int r, i;
+
+    reset_heap();
+    for (r = 0; r < nops / (2 * NBLOCKS); r++) {
+        fill_blocks(k->size);
+        for (i = NBLOCKS - 1; i >= 0; i--)
+            mb_free(blocks[i]);
+    }
+    k->allocs = (double)r * NBLOCKS;
+    k->ops = 2 * k->allocs;
+}
+
+static void k_fifo(void *argp)
+{
+    kparams_t *k = argp;
+    int r, i;
+
+    reset_heap();
+    for (r = 0; r < nops / (2 * NBLOCKS); r++) {
+        fill_blocks(k->size);
+        for (i = 0; i < NBLOCKS; i++)
+            mb_free(blocks[i]);
+    }
+    k->allocs = (double)r * NBLOCKS;
+    k->ops = 2 * k->allocs;
+}
+
+static void k_random(void *argp)
+{
+    kparams_t *k = argp;
+    unsigned int seed = 12345;
+    int r, i;
+
+    reset_heap();
+    for (r = 0; r < nops / (2 * NBLOCKS); r++) {
+        fill_blocks(k->size);
+        /* Fisher-Yates; the shuffle is part of the timed run but is
+         * cheap next to the calls */
+        for (i = NBLOCKS - 1; i > 0; i--) {
+            int j = rand_next(&seed) % (i + 1);
+            void *t = blocks[i];
+            blocks[i] = blocks[j];
+            blocks[j] = t;
+        }
+        for (i = 0; i < NBLOCKS; i++)
+            mb_free(blocks[i]);
+    }
+    k->allocs = (double)r * NBLOCKS;
+    k->ops = 2 * k->allocs;
+}
+
+static void k_realloc(void *argp)
+{
+    kparams_t *k = argp;
+    void *chain[NCHAINS];
+    size_t size[NCHAINS];
+    double ops = 0, frees = 0;
+    int c;
+
+    reset_heap();
+    while (ops < nops) {
+        for (c = 0; c < NCHAINS; c++) {
+            size[c] = 16;
+            chain[c] = xmalloc(size[c]);
+        }
+        ops += NCHAINS;
+        /* Grow all chains by 1.5x in turn, so neighbours get in the way */
+        while (size[0] < MAXGROW) {
+            for (c = 0; c < NCHAINS; c++) {
+                size[c] += size[c] / 2;
+                if ((chain[c] = mb_realloc(chain[c], size[c])) == NULL)
+                    longjmp(oom_jmpbuf, 1);
+            }
+            ops += NCHAINS;
+        }
+        for (c = 0; c < NCHAINS; c++)
+            mb_free(chain[c]);
+        ops += NCHAINS;
+        frees += NCHAINS;
+    }
+    k->ops = ops;
+    k->allocs = ops - frees;
+}
+
+/*****************
+ * Thread kernels
+ *****************/
+
+typedef struct {
+    void **slots;
+    unsigned int seed;
+    int nops;
+} larson_arg_t;
+
+static void *larson_thread(void *argp)
+{
+    larson_arg_t *a = argp;
+    int i;
+
+    for (i = 0; i < a->nops; i++) {
+        int s = rand_next(&a->seed) % NSLOTS;
+        tfree(a->slots[s]);
+        if ((a->slots[s] = tmalloc(16 + rand_next(&a->seed) % 512)) == NULL)
+            return THREAD_OOM;
+    }
+    return NULL;
+}
+
+static void k_larson(void *argp)
+{
+    kparams_t *k = argp;
+    pthread_t tid[nthreads];
+    larson_arg_t arg[nthreads];
+    void **slots[nthreads];
+    void *ret;
+    int t, r, i, oom = 0;
+    int per_thread = nops / (nthreads * NROUNDS);
+
+    reset_heap();
+    for (t = 0; t < nthreads; t++) {
+        if ((slots[t] = malloc(NSLOTS * sizeof(void *))) == NULL) {
+            fprintf(stderr, "malloc failed in k_larson\n");
+            exit(1);
+        }
+        for (i = 0; i < NSLOTS; i++)
+            if ((slots[t][i] = tmalloc(16 + i % 512)) == NULL)
+                oom = 1;
+    }
+
+    for (r = 0; r < NROUNDS && !oom; r++) {
+        /* Each round a thread inherits another thread's blocks */
+        for (t = 0; t < nthreads; t++) {
+            arg[t].slots = slots[(t + r) % nthreads];
+            arg[t].seed = 1 + t + r * nthreads;
+            arg[t].nops = per_thread;
+            pthread_create(&tid[t], NULL, larson_thread, &arg[t]);
+        }
+        for (t = 0; t < nthreads; t++) {
+            pthread_join(tid[t], &ret);
+            if (ret == THREAD_OOM)
+                oom = 1;
+        }
+    }
+
+    for (t = 0; t < nthreads; t++) {
+        for (i = 0; i < NSLOTS; i++)
+            mb_free(slots[t][i]);
+        free(slots[t]);
+    }
+    if (oom)
+        longjmp(oom_jmpbuf, 1);
+    k->allocs = (double)nthreads * (NSLOTS + NROUNDS * per_thread);
+    k->ops = 2 * k->allocs;
+}
+
+/* Single-producer single-consumer queue of blocks */
+static void *queue[QUEUE_LEN];
+static volatile unsigned long q_head, q_tail;
+
+static void *producer(void *argp)
+{
+    size_t size = ((kparams_t *)argp)->size;
+    int i;
+
+    for (i = 0; i < nops / 2; i++) {
+        void *p = tmalloc(size);
+        while (q_head - __atomic_load_n(&q_tail, __ATOMIC_ACQUIRE) == QUEUE_LEN)
+            sched_yield();
+        queue[q_head % QUEUE_LEN] = p;
+        __atomic_store_n(&q_head, q_head + 1, __ATOMIC_RELEASE);
+        if (p == NULL)      /* tells the consumer to stop too */
+            return THREAD_OOM;
+    }
+    return NULL;
+}
+
+static void *consumer(void *argp __attribute__((unused)))
+{
+    int i;
+
+    for (i = 0; i < nops / 2; i++) {
+        void *p;
+        while (__atomic_load_n(&q_head, __ATOMIC_ACQUIRE) == q_tail)
+            sched_yield();
+        p = queue[q_tail % QUEUE_LEN];
+        __atomic_store_n(&q_tail, q_tail + 1, __ATOMIC_RELEASE);
+        if (p == NULL)
+            break;
+        tfree(p);
+    }
+    return NULL;
+}
+
+static void k_prodcons(void *argp)
+{
+    kparams_t *k = argp;
+    pthread_t ptid, ctid;
+    void *ret;
+
+    reset_heap();
+    q_head = q_tail = 0;
+    pthread_create(&ptid, NULL, producer, k);
+    pthread_create(&ctid, NULL, consumer, k);
+    pthread_join(ptid, &ret);
+    pthread_join(ctid, NULL);
+    if (ret == THREAD_OOM)
+        longjmp(oom_jmpbuf, 1);
+    k->allocs = nops / 2;
+    k->ops = 2 * k->allocs;
+}
+
+/*************
+ * The driver
+ *************/
+
+static const struct {
+    const char *name;
+    fsecs_test_funct f;
+    size_t sizes[6];   /* 0-terminated; fixed-size kernels only */
+} kernels[] = {
+    { "pairs",    k_pairs,    { 16, 64, 256, 1024, 4096, 0 } },
+    { "lifo",     k_lifo,     { 64, 0 } },
+    { "fifo",     k_fifo,     { 64, 0 } },
+    { "random",   k_random,   { 64, 0 } },
+    { "realloc",  k_realloc,  { 0 } },
+    { "larson",   k_larson,   { 0 } },
+    { "prodcons", k_prodcons, { 64, 0 } },
+};
+#define NUM_KERNELS (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static void run_kernel(int n, size_t size)
+{
+    kparams_t k;
+    double secs;
+
+    k.size = size;
+    k.ops = k.allocs = 0;
+
+    printf("%-8s %-9s", MB_NAME, kernels[n].name);
+    if (size)
+        printf(" %6zu", size);
+    else
+        printf(" %6s", "-");
+
+    if (setjmp(oom_jmpbuf) != 0) {
+        printf(" %9s %9s %12s  (out of memory)\n", "-", "-", "-");
+        return;
+    }
+    secs = fsecs(kernels[n].f, &k);
+    printf(" %9.0f %9.1f %12.0f\n", k.ops, secs * 1e9 / k.ops,
+           (k.allocs / 1e3) / secs);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mbench [-hv] [-n <ops>] [-t <threads>] [-k <kernel>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h           Print this message.\n");
+    fprintf(stderr, "\t-v           Print timer diagnostics.\n");
+    fprintf(stderr, "\t-n <ops>     Operations per kernel run (default %d).\n", NOPS);
+    fprintf(stderr, "\t-t <threads> Threads for larson (default 2).\n");
+    fprintf(stderr, "\t-k <kernel>  Run only this kernel.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int i, n;
+    int c;
+    char *only = NULL;
+
+    while ((c = getopt(argc, argv, "hvn:t:k:")) != EOF) {
+        switch (c) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'n':
+            nops = atoi(optarg);
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'k':
+            only = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (nops < 2 * NBLOCKS || nthreads < 1) {
+        fprintf(stderr, "need at least %d ops and one thread\n", 2 * NBLOCKS);
+        exit(1);
+    }
+
+    if ((blocks = malloc(NBLOCKS * sizeof(void *))) == NULL) {
+        fprintf(stderr, "malloc failed in main\n");
+        exit(1);
+    }
+#ifndef MBENCH_LIBC
+    mem_init();
+#endif
+    init_fsecs();
+
+    printf("%-8s %-9s %6s %9s %9s %12s\n",
+           "malloc", "kernel", "size", "ops", "ns/op", "Kallocs/s");
+    for (n = 0; n < NUM_KERNELS; n++) {
+        if (only && strcmp(only, kernels[n].name))
+            continue;
+        if (kernels[n].sizes[0] == 0) {
+            run_kernel(n, 0);
+            continue;
+        }
+        for (i = 0; kernels[n].sizes[i]; i++)
+            run_kernel(n, kernels[n].sizes[i]);
+    }
+    return 0;
+}
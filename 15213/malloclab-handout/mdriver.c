@@ -7,9 +7,13 @@
  * Copyright (c) 2004, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -18,12 +22,23 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fcyc.h"
+#include "clock.h"
 #include "config.h"
+#include "backend.h"
+#include "lathist.h"
+#include "perfctr.h"
+#include "cachesim.h"
+#include "tracefmt.h"
 
 /**********************
  * Constants and macros
@@ -32,6 +47,7 @@
 /* Misc */
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
+#define MT_REPS        5 /* replays per -T measurement; the best is kept */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
@@ -54,29 +70,38 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload. The records form a treap
+ * keyed by lo: a binary search tree that is also a heap on prio, which
+ * keeps it balanced in expectation.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges below lo */
+    struct range_t *right; /* ranges above lo */
+    unsigned prio;         /* heap priority, a hash of lo */
     int index;             /* same index as free; for debugging */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    int index;                        /* index for free() to use later */
-    size_t size;                      /* byte size of alloc/realloc request */
-} traceop_t;
+/*
+ * Characterizes a single trace operation (allocator request). This is
+ * the record of the binary trace format, so binary traces are used in
+ * place: type, index (for free() to use later) and size (byte size of
+ * alloc/realloc request).
+ */
+typedef tf_op_t traceop_t;
+enum { ALLOC = TF_ALLOC, FREE = TF_FREE, REALLOC = TF_REALLOC };
 
 /* Holds the information for one trace file*/
 typedef struct {
     char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
+    int ignore_ranges;   /* historical .rep flag; no longer consulted */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
     int weight;          /* weight for this trace (unused) */
     traceop_t *ops;      /* array of requests */
+    tf_map_t map;        /* the mapped file, if this is a binary trace */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
@@ -92,6 +117,23 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* The aggregate results of a run, for the machine-readable outputs */
+typedef struct {
+    int numcorrect;     /* traces run correctly */
+    double util;        /* average util of the util-weighted traces */
+    double throughput;  /* ops/sec over the perf-weighted traces */
+    double perfindex;
+} summary_t;
+
+/* Holds the params and results of one replay thread (-T) */
+typedef struct {
+    trace_t *trace;             /* this thread's trace and index space */
+    pthread_barrier_t *ready;   /* released when all threads are ready */
+    double start, end;          /* wall clock times of this thread's replay */
+    double secs;                /* time for this thread's replay */
+    int failed;                 /* set if an allocation failed */
+} replay_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -106,6 +148,24 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* set only with --samples: secs is then the median sample */
+    double secs_lo;  /* 95% confidence interval of secs */
+    double secs_hi;
+    int samples;     /* samples timed, and kept after outlier rejection */
+    int kept;
+
+    /* set only with --cold, by the same estimator as secs */
+    double cold_secs; /* secs with the caches flushed before each run */
+    double cold_lo;   /* with --samples, its 95% confidence interval */
+    double cold_hi;
+
+    /* set only with --rss, from the util run */
+    long minflt;           /* minor page faults */
+    size_t heap_bytes;     /* the heap, up to the brk */
+    size_t resident_bytes; /* pages of the heap actually resident */
+    long maxrss_kb;        /* peak RSS of mdriver so far */
+    double rss_util;       /* peak payload over resident_bytes */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
@@ -117,11 +177,18 @@ typedef struct {
  * realloc and when we free.  With DBG_EXPENSIVE, we check every block
  * every operation.
  * randint_t should be a byte, in case students return unaligned memory.
+ *
+ * random_data holds the pattern twice over, so the RANDOM_DATA_LEN
+ * bytes starting at any offset below RANDOM_DATA_LEN are contiguous.
+ * A block is then filled and checked a run at a time with memcpy and
+ * memcmp, which libc implements with the widest vector instructions
+ * the CPU has (SSE2, AVX2, ...); only a garbled run is rescanned byte
+ * by byte, to count and locate the damage.
  *******************/
 #define RANDOM_DATA_LEN (1<<16)
 typedef unsigned char randint_t;
 static const char randint_t_name[] = "byte";
-static randint_t random_data[RANDOM_DATA_LEN];
+static randint_t random_data[2 * RANDOM_DATA_LEN];
 
 
 /********************
@@ -134,9 +201,46 @@ int verbose = 1;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 int onetime_flag = 0;
 
+/* If set, also time every call of the mm package (set by -L) */
+static int latency_flag = 0;
+
+/* If set, also count hardware events of the mm package (set by -C) */
+static int counters_flag = 0;
+static perfctr_t perfctr;
+
+/* If set, also profile the phases of mm.c (set by --profile) */
+static int profile_flag = 0;
+
+/* If set, also simulate the caches and TLB under mm.c (set by --sim) */
+static int sim_flag = 0;
+static cachesim_t cachesim;
+
+/* If set, sample the heap footprint every timeline_interval requests
+   into this file (set by --timeline and --interval) */
+static FILE *timeline = NULL;
+static int timeline_interval = 1000;
+
+/* If set, time each trace by the median of this many samples, with a
+   confidence interval, instead of the K-best (set by --samples) */
+static int robust_samples = 0;
+static int robust_warmups = 2;
+
+/* If set, also measure the resident memory of the heap (set by --rss) */
+static int rss_flag = 0;
+
+/* If set, also time each trace with cold caches (set by --cold) */
+static int cold_flag = 0;
+
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* With -j, the next trace for a worker to take; shared by the workers */
+static int *next_trace = NULL;
+
+/* With -j, a file per trace for the reports of its worker, which the
+   parent prints in trace order; otherwise the reports go to stdout */
+static FILE **trace_reports = NULL;
+
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -148,11 +252,42 @@ static char *default_tracefiles[] = {
 
 char autoresult[MAXLINE]; /* autoresult string */
 
+/* The compiler flags mdriver was built with (set by the Makefile) */
+#ifndef MDRIVER_CFLAGS
+#define MDRIVER_CFLAGS "unknown"
+#endif
+
+/* Long-only command line options */
+enum { OPT_JSON = 256, OPT_CSV, OPT_BASELINE, OPT_THRESHOLD, OPT_TIMELINE,
+       OPT_INTERVAL, OPT_SAMPLES, OPT_WARMUPS, OPT_TIMER, OPT_COLD,
+       OPT_PROFILE, OPT_SIM, OPT_RSS, OPT_RESERVE, OPT_CHECK_CTX };
+static const struct option long_options[] = {
+    { "json", required_argument, NULL, OPT_JSON },
+    { "csv", required_argument, NULL, OPT_CSV },
+    { "baseline", required_argument, NULL, OPT_BASELINE },
+    { "timeline", required_argument, NULL, OPT_TIMELINE },
+    { "interval", required_argument, NULL, OPT_INTERVAL },
+    { "samples", required_argument, NULL, OPT_SAMPLES },
+    { "warmups", required_argument, NULL, OPT_WARMUPS },
+    { "timer", required_argument, NULL, OPT_TIMER },
+    { "cold", no_argument, NULL, OPT_COLD },
+    { "profile", no_argument, NULL, OPT_PROFILE },
+    { "sim", required_argument, NULL, OPT_SIM },
+    { "rss", no_argument, NULL, OPT_RSS },
+    { "reserve", required_argument, NULL, OPT_RESERVE },
+    { "check-ctx", no_argument, NULL, OPT_CHECK_CTX },
+    { "threshold", required_argument, NULL, OPT_THRESHOLD },
+    { NULL, 0, NULL, 0 }
+};
+
+/* The allocator under test, normally mm.c (see backend.h) */
+static const backend_t *mm_funcs = &backends[0];
+
 /*********************
  * Function prototypes
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
@@ -169,18 +304,53 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
-/* Routines for evaluating the correctness and speed of libc malloc */
-static int eval_libc_valid(trace_t *trace);
-static void eval_libc_speed(void *ptr);
-
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum);
+static void eval_mm_timeline(trace_t *trace, int tracenum);
+static FILE *open_timeline(const char *filename);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, lathist_t *hist);
+static void print_latency(FILE *out, const char *filename,
+                          const lathist_t *hist);
+static void eval_mm_counters(speed_t *speed_params);
+static void print_counters(FILE *out, const char *filename, int ops);
+static void eval_mm_profile(speed_t *speed_params, mm_profile_t *prof);
+static void eval_mm_sim(trace_t *trace);
+static void print_sim(FILE *out, const char *filename, int ops);
+static void print_profile(FILE *out, const char *filename, int ops,
+                          const mm_profile_t *prof);
+
+/* Runs several backends over the same traces (-b, -P) */
+static void run_backends(int nb, const backend_t **b, stats_t **stats,
+                         int njobs, int num_tracefiles, const char *tracedir,
+                         char **tracefiles, range_t *ranges,
+                         speed_t *speed_params);
+static int parse_backends(const char *list, const backend_t **b);
+static void run_fit_policies(int njobs, int num_tracefiles,
+                             const char *tracedir, char **tracefiles,
+                             range_t *ranges, speed_t *speed_params);
+static void run_parallel(int njobs, int num_tracefiles, const char *tracedir,
+                         char **tracefiles, stats_t *mm_stats,
+                         range_t *ranges, speed_t *speed_params);
+static void run_threads(int nthreads, int mixed, int num_tracefiles,
+                        const char *tracedir, char **tracefiles,
+                        range_t *ranges);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void print_robust(int n, const stats_t *stats);
+static void print_cold(int n, const stats_t *stats);
+static void print_rss(int n, const stats_t *stats);
+static void kops_interval(const stats_t *st, double *lo, double *hi);
+static void write_results(const char *filename, int csv, int n,
+                          const stats_t *stats, const summary_t *sum);
+static int compare_baseline(const char *filename, double threshold,
+                            int n, const stats_t *stats);
+static void average_stats(int n, const stats_t *stats,
+                          double *avg_util, double *avg_throughput);
+static void check_mem_ctx(void);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -198,15 +368,24 @@ static void timeout_handler(int sig __attribute__((unused))) {
     longjmp(timeout_jmpbuf, 1);
 }
 
+/* claim_trace - Return the trace to run after trace i */
+static int claim_trace(int i)
+{
+    if (next_trace == NULL)
+        return i + 1;
+    return __atomic_fetch_add(next_trace, 1, __ATOMIC_RELAXED);
+}
+
 /* Run the tests; return the number of tests run (may be less than
-   num_tracefiles, if there's a timeout) */
+   num_tracefiles, if there's a timeout). In a -j worker, the traces
+   are shared out through next_trace instead of taken in order. */
 static void run_tests(int num_tracefiles, const char *tracedir,
                       char **tracefiles, 
                       stats_t *mm_stats, range_t *ranges, speed_t *speed_params) {
     volatile int i;
     volatile int timed_out = 0;
 
-    for (i=0; i < num_tracefiles; i++) {
+    for (i = claim_trace(-1); i < num_tracefiles; i = claim_trace(i)) {
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
         mem_init();
@@ -233,16 +412,99 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             }
         }
         if (mm_stats[i].valid) {
+            FILE *out = trace_reports ? trace_reports[i] : stdout;
+
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            if (mm_funcs->memlib) {
+                struct rusage ru;
+                long minflt = 0;
+
+                /* With --rss, the util run starts with no heap pages
+                   resident, writes every page of its payloads, and
+                   its page faults are counted */
+                if (rss_flag) {
+                    mem_drop_pages();
+                    getrusage(RUSAGE_SELF, &ru);
+                    minflt = ru.ru_minflt;
+                }
+                mm_stats[i].util = eval_mm_util(trace, i);
+                if (rss_flag) {
+                    getrusage(RUSAGE_SELF, &ru);
+                    mm_stats[i].minflt = ru.ru_minflt - minflt;
+                    mm_stats[i].maxrss_kb = ru.ru_maxrss;
+                    mm_stats[i].heap_bytes = mem_heapsize();
+                    mm_stats[i].resident_bytes = mem_resident();
+                    /* The util run touches every page of the payloads,
+                       so the peak payload fits in the resident pages */
+                    if (mm_stats[i].resident_bytes > 0)
+                        mm_stats[i].rss_util = mm_stats[i].util *
+                            mm_stats[i].heap_bytes / mm_stats[i].resident_bytes;
+                    if (mm_stats[i].rss_util > 1)
+                        mm_stats[i].rss_util = 1;
+                }
+            }
+            if (timeline && mm_funcs->memlib)
+                eval_mm_timeline(trace, i);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            if (robust_samples) {
+                fsecs_stats_t st;
+
+                mm_stats[i].secs = fsecs_robust(eval_mm_speed, speed_params,
+                                                &st);
+                mm_stats[i].secs_lo = st.lo;
+                mm_stats[i].secs_hi = st.hi;
+                mm_stats[i].samples = st.samples;
+                mm_stats[i].kept = st.kept;
+            } else {
+                mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            }
+
+            if (cold_flag) {
+                /* The heap is as large as the util run left it */
+                set_fsecs_cold(1, mm_funcs->memlib ? mem_heap_lo() : NULL,
+                               mm_funcs->memlib ? mem_heapsize() : 0);
+                if (robust_samples) {
+                    fsecs_stats_t st;
+
+                    mm_stats[i].cold_secs = fsecs_robust(eval_mm_speed,
+                                                         speed_params, &st);
+                    mm_stats[i].cold_lo = st.lo;
+                    mm_stats[i].cold_hi = st.hi;
+                } else {
+                    mm_stats[i].cold_secs = fsecs(eval_mm_speed, speed_params);
+                }
+                set_fsecs_cold(0, NULL, 0);
+            }
+
+            if (latency_flag) {
+                static lathist_t hist[3]; /* one per request type */
+                eval_mm_latency(trace, hist);
+                print_latency(out, trace->filename, hist);
+            }
+
+            if (counters_flag) {
+                eval_mm_counters(speed_params);
+                print_counters(out, trace->filename, trace->num_ops);
+            }
+
+            if (profile_flag) {
+                mm_profile_t prof;
+                eval_mm_profile(speed_params, &prof);
+                print_profile(out, trace->filename, trace->num_ops, &prof);
+            }
+
+            if (sim_flag) {
+                eval_mm_sim(trace);
+                print_sim(out, trace->filename, trace->num_ops);
+            }
         }
 
+        if (trace_reports)  /* _exit will not flush it */
+            fflush(trace_reports[i]);
         free_trace(trace);
 
         /* clean up memory system */
@@ -250,13 +512,117 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * run_parallel - Run the tests in njobs worker processes. Each worker
+ *     has its own copy of the simulated heap, is pinned to its own CPU
+ *     so the timings are not disturbed by migrations, and takes the
+ *     next unclaimed trace whenever it finishes one. The workers write
+ *     their results straight into a shared copy of mm_stats, and their
+ *     reports into a temporary file per trace, printed once all are done.
+ */
+static void run_parallel(int njobs, int num_tracefiles, const char *tracedir,
+                         char **tracefiles, stats_t *mm_stats,
+                         range_t *ranges, speed_t *speed_params)
+{
+    cpu_set_t allowed, mine;
+    int *cpus, ncpus = 0, *shared_errors;
+    int w, cpu, status, nfailed = 0;
+    size_t len, n;
+    char buf[BUFSIZ];
+    stats_t *shared;
+    pid_t pid;
+
+    /* One CPU per worker, from the CPUs we may run on */
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        unix_error("sched_getaffinity failed in run_parallel");
+    if ((cpus = malloc(CPU_SETSIZE * sizeof(int))) == NULL)
+        unix_error("malloc failed in run_parallel");
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed))
+            cpus[ncpus++] = cpu;
+    if (njobs > ncpus) {
+        fprintf(stderr, "Only %d CPUs available, using -j %d\n", ncpus, ncpus);
+        njobs = ncpus;
+    }
+    if (njobs > num_tracefiles)
+        njobs = num_tracefiles;
+
+    /* The results, the work counter and the error count are shared */
+    len = num_tracefiles * sizeof(stats_t) + 2 * sizeof(int);
+    shared = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        unix_error("mmap failed in run_parallel");
+    next_trace = (int *)(shared + num_tracefiles);
+    shared_errors = next_trace + 1;
+
+    if ((trace_reports = calloc(num_tracefiles, sizeof(FILE *))) == NULL)
+        unix_error("calloc failed in run_parallel");
+    for (w = 0; w < num_tracefiles; w++)
+        if ((trace_reports[w] = tmpfile()) == NULL)
+            unix_error("tmpfile failed in run_parallel");
+
+    for (w = 0; w < njobs; w++) {
+        if ((pid = fork()) < 0)
+            unix_error("fork failed in run_parallel");
+        if (pid == 0) {
+            if (counters_flag) {  /* count this process, not the parent */
+                pc_close(&perfctr);
+                pc_open(&perfctr);
+            }
+            CPU_ZERO(&mine);
+            CPU_SET(cpus[w], &mine);
+            if (sched_setaffinity(0, sizeof(mine), &mine) < 0)
+                unix_error("sched_setaffinity failed in run_parallel");
+            if (set_timeout > 0) {
+                signal(SIGALRM, timeout_handler);
+                alarm(set_timeout);
+            }
+            run_tests(num_tracefiles, tracedir, tracefiles, shared,
+                      ranges, speed_params);
+            __atomic_fetch_add(shared_errors, errors, __ATOMIC_RELAXED);
+            _exit(0);
+        }
+    }
+
+    /* A worker that died leaves its trace without results */
+    for (w = 0; w < njobs; w++) {
+        if (wait(&status) < 0)
+            unix_error("wait failed in run_parallel");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            nfailed++;
+    }
+    if (nfailed > 0)
+        fprintf(stderr, "%d of the %d workers failed\n", nfailed, njobs);
+    errors += *shared_errors + nfailed;
+
+    /* The workers share the file offsets, so read each from the top */
+    for (w = 0; w < num_tracefiles; w++) {
+        rewind(trace_reports[w]);
+        while ((n = fread(buf, 1, sizeof(buf), trace_reports[w])) > 0)
+            fwrite(buf, 1, n, stdout);
+        fclose(trace_reports[w]);
+    }
+    free(trace_reports);
+    trace_reports = NULL;
+
+    memcpy(mm_stats, shared, num_tracefiles * sizeof(stats_t));
+    for (w = 0; w < num_tracefiles; w++)
+        if (mm_stats[w].filename[0] == '\0')
+            snprintf(mm_stats[w].filename, MAXLINE, "%s%s",
+                     tracedir, tracefiles[w]);
+
+    munmap(shared, len);
+    next_trace = NULL;
+    free(cpus);
+}
+
 /**************
  * Main routine
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
 
@@ -266,7 +632,20 @@ int main(int argc, char **argv)
     speed_t speed_params;      /* input parameters to the xx_speed routines */
 
     int run_libc = 0;     /* If set, run libc malloc (set by -l) */
+    int run_policies = 0; /* If set, sweep the fit policies (set by -P) */
+    const backend_t *run_b[num_backends]; /* backends to compare (-b) */
+    int num_run_b = 0;
+    int nthreads = 0;     /* If set, replay on this many threads (-T) */
+    int mixed = 0;        /* If set, -T threads replay different traces (-M) */
+    int njobs = 1;        /* worker processes for the mm run (-j) */
     int autograder = 0;   /* if set then called by autograder (-A) */
+    int check_ctx = 0;    /* if set then only check memlib (--check-ctx) */
+    char *json_file = NULL;     /* write results as JSON here (--json) */
+    char *csv_file = NULL;      /* write results as CSV here (--csv) */
+    char *baseline_file = NULL; /* compare with these results (--baseline) */
+    double threshold = 5.0;     /* allowed regression in % (--threshold) */
+    int regressions = 0;
+    summary_t summary;
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput = 0, p1, p2, perfindex;
@@ -280,9 +659,90 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+    while ((c = getopt_long(argc, argv, "b:d:f:c:s:t:v:T:j:hVAlCDLMP",
+                            long_options, NULL)) != EOF) {
         switch (c) {
 
+        case OPT_JSON: /* Write the results as JSON */
+            json_file = optarg;
+            break;
+
+        case OPT_CSV: /* Write the results as CSV */
+            csv_file = optarg;
+            break;
+
+        case OPT_BASELINE: /* Compare with the CSV results of an earlier run */
+            baseline_file = optarg;
+            break;
+
+        case OPT_THRESHOLD: /* Regression that fails the baseline check */
+            threshold = atof(optarg);
+            break;
+
+        case OPT_TIMELINE: /* Sample the heap footprint into a CSV file */
+            timeline = open_timeline(optarg);
+            break;
+
+        case OPT_TIMER: /* Choose the timer */
+            if (set_fsecs_timer(optarg) < 0)
+                app_error("Unknown timer %s (try -h)\n", optarg);
+            break;
+
+        case OPT_PROFILE: /* Profile the phases of mm.c */
+            profile_flag = 1;
+            break;
+
+        case OPT_SIM: /* Simulate the caches and TLB */
+            if (cs_init(&cachesim, strcmp(optarg, "default") ? optarg : NULL) < 0)
+                app_error("Bad cache spec %s (try -h)\n", optarg);
+            sim_flag = 1;
+            break;
+
+        case OPT_RSS: /* Measure resident memory */
+            rss_flag = 1;
+            break;
+
+        case OPT_RESERVE: { /* Size of the simulated heap */
+            char *end;
+            size_t bytes = strtoul(optarg, &end, 10);
+
+            switch (*end) {
+            case 'G': case 'g': bytes <<= 10; /* fall through */
+            case 'M': case 'm': bytes <<= 10; /* fall through */
+            case 'K': case 'k': bytes <<= 10; end++; break;
+            }
+            if (end == optarg || *end != '\0' || bytes == 0)
+                app_error("Bad heap size %s (try -h)\n", optarg);
+            mem_set_reserve(bytes);
+            break;
+        }
+
+        case OPT_CHECK_CTX: /* Check the heap contexts of memlib and exit */
+            check_ctx = 1;
+            break;
+
+        case OPT_COLD: /* Also time with cold caches */
+            cold_flag = 1;
+            break;
+
+        case OPT_SAMPLES: /* Time by the median of this many samples */
+            robust_samples = atoi(optarg);
+            if (robust_samples < 3)
+                app_error("--samples needs at least three samples");
+            break;
+
+        case OPT_WARMUPS: /* Untimed runs before the --samples */
+            robust_warmups = atoi(optarg);
+            if (robust_warmups < 0)
+                app_error("--warmups cannot be negative");
+            break;
+
+        case OPT_INTERVAL: /* Requests between footprint samples */
+            timeline_interval = atoi(optarg);
+            if (timeline_interval < 1)
+                app_error("--interval needs at least one request");
+            break;
+
         case 'A': /* Hidden Autolab driver argument */
             autograder = 1;
             break;
@@ -318,6 +778,38 @@ int main(int argc, char **argv)
             run_libc = 1;
             break;
 
+        case 'b': /* Compare these backends */
+            num_run_b = parse_backends(optarg, run_b);
+            break;
+
+        case 'C': /* Count hardware events */
+            counters_flag = 1;
+            break;
+
+        case 'L': /* Report per-request latencies */
+            latency_flag = 1;
+            break;
+
+        case 'P': /* Compare the fit policies */
+            run_policies = 1;
+            break;
+
+        case 'T': /* Replay each trace on several threads at once */
+            nthreads = atoi(optarg);
+            if (nthreads < 1)
+                app_error("-T needs at least one thread");
+            break;
+
+        case 'j': /* Run the traces in several worker processes */
+            njobs = atoi(optarg);
+            if (njobs < 1)
+                app_error("-j needs at least one worker");
+            break;
+
+        case 'M': /* Give the -T threads different traces */
+            mixed = 1;
+            break;
+
         case 'V': /* Increase verbosity level */
             verbose += 1;
             break;
@@ -360,9 +852,28 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (robust_samples)
+        set_fsecs_robust(robust_warmups, robust_samples);
+    if (cold_flag && set_fsecs_cold(1, NULL, 0) < 0)
+        app_error("--cold needs the tsc or clock timer\n");
+    set_fsecs_cold(0, NULL, 0);
+
+    /* Make sure the heap contexts of memlib keep to themselves */
+    if (check_ctx) {
+        check_mem_ctx();
+        printf("Heap contexts are independent.\n");
+        exit(0);
+    }
 
-    /* Initialize the timeout */
-    if (set_timeout > 0) {
+    /* Open the hardware counters, or carry on without them */
+    if (counters_flag && pc_open(&perfctr) == 0) {
+        fprintf(stderr, "Hardware counters unavailable: %s\n", pc_error());
+        counters_flag = 0;
+    }
+
+    /* Initialize the timeout (not supported with -T; -j workers set
+       their own) */
+    if (set_timeout > 0 && nthreads == 0 && njobs == 1) {
         signal(SIGALRM, timeout_handler);
         alarm(set_timeout); 
     }
@@ -379,21 +890,11 @@ int main(int argc, char **argv)
         if (libc_stats == NULL)
             unix_error("libc_stats calloc in main failed");
 
-        /* Evaluate the libc malloc package using the K-best scheme */
-        for (i=0; i < num_tracefiles; i++) {
-            trace_t *trace = read_trace(&libc_stats[i], tracedir, tracefiles[i]);
-
-            if (verbose > 1)
-                printf("Checking libc malloc for correctness, ");
-            libc_stats[i].valid = eval_libc_valid(trace);
-            if (libc_stats[i].valid) {
-                speed_params.trace = trace;
-                if (verbose > 1)
-                    printf("and performance.\n");
-                libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-            }
-            free_trace(trace);
-        }
+        /* Evaluate the libc malloc package through its backend */
+        mm_funcs = find_backend("libc");
+        run_tests(num_tracefiles, tracedir, tracefiles, libc_stats,
+                  ranges, &speed_params);
+        mm_funcs = &backends[0];
 
         /* Display the libc results in a compact table */
         if (verbose) {
@@ -402,6 +903,37 @@ int main(int argc, char **argv)
         }
     }
 
+    /*
+     * Optionally compare every fit policy build instead of mm.o
+     */
+    if (run_policies) {
+        run_fit_policies(njobs, num_tracefiles, tracedir, tracefiles,
+                         ranges, &speed_params);
+        exit(0);
+    }
+
+    /*
+     * Optionally compare several backends instead of mm.c alone
+     */
+    if (num_run_b > 0) {
+        stats_t *stats[num_backends];
+
+        run_backends(num_run_b, run_b, stats, njobs, num_tracefiles,
+                     tracedir, tracefiles, ranges, &speed_params);
+        for (i = 0; i < num_run_b; i++)
+            free(stats[i]);
+        exit(errors ? 1 : 0);
+    }
+
+    /*
+     * Optionally measure scalability instead of the single-thread run
+     */
+    if (nthreads) {
+        run_threads(nthreads, mixed, num_tracefiles, tracedir, tracefiles,
+                    ranges);
+        exit(0);
+    }
+
     /*
      * Always run and evaluate the student's mm package
      */
@@ -413,8 +945,12 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
-              ranges, &speed_params);
+    if (njobs > 1 && !onetime_flag)
+        run_parallel(njobs, num_tracefiles, tracedir, tracefiles, mm_stats,
+                     ranges, &speed_params);
+    else
+        run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                  ranges, &speed_params);
 
 
     /* Display the mm results in a compact table */
@@ -430,6 +966,18 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats);
             printf("\n");
+            if (robust_samples) {
+                print_robust(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (cold_flag) {
+                print_cold(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (rss_flag) {
+                print_rss(num_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -541,27 +1089,103 @@ int main(int argc, char **argv)
         printf("\nAUTORESULT_STRING=%s\n", autoresult);
     }
 
+    /* Optionally write machine-readable results */
+    summary.numcorrect = numcorrect;
+    summary.util = avg_mm_util;
+    summary.throughput = avg_mm_throughput;
+    summary.perfindex = perfindex;
+    if (json_file)
+        write_results(json_file, 0, num_tracefiles, mm_stats, &summary);
+    if (csv_file)
+        write_results(csv_file, 1, num_tracefiles, mm_stats, &summary);
+
+    /* Optionally gate on an earlier run */
+    if (baseline_file) {
+        regressions = compare_baseline(baseline_file, threshold,
+                                       num_tracefiles, mm_stats);
+        if (regressions) {
+            printf("FAILED: %d trace(s) regressed more than %.1f%%\n",
+                   regressions, threshold);
+            exit(1);
+        }
+    }
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. Adding and
+ * removing a range take O(log n) expected time, so the check stays
+ * on even for traces with a million requests.
  ****************************************************************/
 
+/* range_prio - Hash a payload address into a treap priority */
+static unsigned range_prio(const char *lo)
+{
+    uint64_t x = (uintptr_t)lo;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned)x;
+}
+
+/* range_insert - Insert p into the subtree at root; returns the new root */
+static range_t *range_insert(range_t *root, range_t *p)
+{
+    range_t *c;
+
+    if (root == NULL)
+        return p;
+    if (p->lo < root->lo) {
+        root->left = range_insert(root->left, p);
+        if (root->left->prio > root->prio) {    /* rotate right */
+            c = root->left;
+            root->left = c->right;
+            c->right = root;
+            return c;
+        }
+    } else {
+        root->right = range_insert(root->right, p);
+        if (root->right->prio > root->prio) {   /* rotate left */
+            c = root->right;
+            root->right = c->left;
+            c->left = root;
+            return c;
+        }
+    }
+    return root;
+}
+
+/* range_join - Merge two treaps, every key of a below every key of b */
+static range_t *range_join(range_t *a, range_t *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (a->prio > b->prio) {
+        a->right = range_join(a->right, b);
+        return a;
+    }
+    b->left = range_join(a, b->left);
+    return b;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred = NULL, *succ = NULL;
 
     assert(size > 0);
 
@@ -573,41 +1197,55 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    if (mm_funcs->memlib &&
+        ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi()))) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
+    if (debug_mode == DBG_NONE) return 1;
 
-
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            malloc_error(trace, opnum,
-                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                         lo, hi, p->lo, p->hi);
-            return 0;
+    /*
+     * The payload must not overlap any other payloads. The ranges in
+     * the tree are disjoint, so only the two neighbours of lo can
+     * overlap: the last range starting at or below lo, and the first
+     * range starting above it.
+     */
+    for (p = *ranges;  p != NULL; ) {
+        if (p->lo <= lo) {
+            pred = p;
+            p = p->right;
+        } else {
+            succ = p;
+            p = p->left;
         }
     }
+    if (pred != NULL && pred->hi >= lo)
+        p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+        p = succ;
+    if (p != NULL) {
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                     lo, hi, p->lo, p->hi);
+        return 0;
+    }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
         unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
+    p->left = p->right = NULL;
+    p->prio = range_prio(lo);
     p->index = index;
-    *ranges = p;
+    *ranges = range_insert(*ranges, p);
 
     return 1;
 }
@@ -618,15 +1256,12 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *ranges) != NULL && p->lo != lo)
+        ranges = lo < p->lo ? &p->left : &p->right;
+    if (p != NULL) {
+        *ranges = range_join(p->left, p->right);
+        free(p);
     }
 }
 
@@ -635,16 +1270,27 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
+    if (p != NULL) {
+        clear_ranges(&p->left);
+        clear_ranges(&p->right);
         free(p);
     }
     *ranges = NULL;
 }
 
+/*
+ * check_ranges - Check the data of every block in the range tree
+ */
+static void check_ranges(const trace_t *trace, int opnum, const range_t *p)
+{
+    for (;  p != NULL;  p = p->right) {
+        check_ranges(trace, opnum, p->left);
+        check_index(trace, opnum, p->index);
+    }
+}
+
 /**********************************************
  * The following routines handle the random data used for
  * checking memory access.
@@ -658,13 +1304,14 @@ static void init_random_data(void) {
     for(len = 0; len < RANDOM_DATA_LEN; ++len) {
         random_data[len] = random();
     }
+    memcpy(random_data + RANDOM_DATA_LEN, random_data, RANDOM_DATA_LEN);
 }
 
 static void randomize_block(trace_t *traces, int index) {
     size_t size;
-    size_t i;
+    size_t i, n;
     randint_t *block;
-    int base;
+    const randint_t *pattern;
 
     if(debug_mode == DBG_NONE) return;
 
@@ -672,18 +1319,19 @@ static void randomize_block(trace_t *traces, int index) {
 
     block = (randint_t*)traces->blocks[index];
     size = traces->block_sizes[index] / sizeof(*block);
-    base = traces->block_rand_base[index];
+    pattern = random_data + traces->block_rand_base[index] % RANDOM_DATA_LEN;
 
-    for(i = 0; i < size; i++) {
-        block[i] = random_data[(base + i) % RANDOM_DATA_LEN];
+    for(i = 0; i < size; i += n) {
+        n = size - i < RANDOM_DATA_LEN ? size - i : RANDOM_DATA_LEN;
+        memcpy(block + i, pattern, n * sizeof(*block));
     }
 }
 
 static void check_index(const trace_t *trace, int opnum, int index) {
     size_t size;
-    size_t i;
+    size_t i, j, n;
     randint_t *block;
-    int base;
+    const randint_t *pattern;
     int ngarbled = 0;
     int firstgarbled = -1;
 
@@ -692,12 +1340,16 @@ static void check_index(const trace_t *trace, int opnum, int index) {
 
     block = (randint_t*)trace->blocks[index];
     size = trace->block_sizes[index] / sizeof(*block);
-    base = trace->block_rand_base[index];
-
-    for(i = 0; i < size; i++) {
-        if(block[i] != random_data[(base + i) % RANDOM_DATA_LEN]) {
-            if(firstgarbled == -1) firstgarbled = i;
-            ngarbled++;
+    pattern = random_data + trace->block_rand_base[index] % RANDOM_DATA_LEN;
+
+    for(i = 0; i < size; i += n) {
+        n = size - i < RANDOM_DATA_LEN ? size - i : RANDOM_DATA_LEN;
+        if(memcmp(block + i, pattern, n * sizeof(*block)) == 0) continue;
+        for(j = 0; j < n; j++) {
+            if(block[i + j] != pattern[j]) {
+                if(firstgarbled == -1) firstgarbled = i + j;
+                ngarbled++;
+            }
         }
     }
     if(ngarbled != 0) {
@@ -717,8 +1369,9 @@ static void check_index(const trace_t *trace, int opnum, int index) {
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
-    FILE *tracefile;
+    FILE *tracefile = NULL;
     trace_t *trace;
+    const char *err;
     char type[MAXLINE];
     int index, size;
     int max_index = 0;
@@ -734,13 +1387,25 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     /* Read the trace file header */
     strcpy(trace->filename, tracedir);
     strcat(trace->filename, filename);
-    if ((tracefile = fopen(trace->filename, "r")) == NULL) {
-        unix_error("Could not open %s in read_trace", trace->filename);
+    if (tf_is_binary(trace->filename)) {
+        /* Binary traces are mapped and used as is (see tracefmt.h) */
+        if ((err = tf_map(&trace->map, trace->filename)) != NULL)
+            app_error("%s: %s\n", trace->filename, err);
+        trace->weight = trace->map.hdr->weight;
+        trace->num_ids = trace->map.hdr->num_ids;
+        trace->num_ops = trace->map.hdr->num_ops;
+        trace->ignore_ranges = trace->map.hdr->ignore_ranges;
+        trace->ops = trace->map.ops;
+    } else {
+        memset(&trace->map, 0, sizeof(trace->map));
+        if ((tracefile = fopen(trace->filename, "r")) == NULL) {
+            unix_error("Could not open %s in read_trace", trace->filename);
+        }
+        fscanf(tracefile, "%d", &trace->weight);
+        fscanf(tracefile, "%d", &trace->num_ids);
+        fscanf(tracefile, "%d", &trace->num_ops);
+        fscanf(tracefile, "%d", &trace->ignore_ranges);
     }
-    fscanf(tracefile, "%d", &trace->weight);
-    fscanf(tracefile, "%d", &trace->num_ids);
-    fscanf(tracefile, "%d", &trace->num_ops);
-    fscanf(tracefile, "%d", &trace->ignore_ranges);
 
     if(trace->weight < 0 || trace->weight > 3) {
         app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
@@ -750,7 +1415,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     }
 
     /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
+    if (tracefile != NULL && (trace->ops =
          (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
@@ -770,13 +1435,16 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         unix_error("malloc 5 failed in read_trace");
 
 
-    /* read every request line in the trace file */
+    /* read every request line in a text trace file */
     index = 0;
     op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
+    while (tracefile != NULL && fscanf(tracefile, "%s", type) != EOF) {
         switch(type[0]) {
         case 'a':
             fscanf(tracefile, "%u %u", &index, &size);
+            if ((unsigned)size > TF_MAX_SIZE)
+                app_error("%s: request size %u too large\n", trace->filename,
+                          (unsigned)size);
             trace->ops[op_index].type = ALLOC;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
@@ -784,6 +1452,9 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
             break;
         case 'r':
             fscanf(tracefile, "%u %u", &index, &size);
+            if ((unsigned)size > TF_MAX_SIZE)
+                app_error("%s: request size %u too large\n", trace->filename,
+                          (unsigned)size);
             trace->ops[op_index].type = REALLOC;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
@@ -801,9 +1472,11 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         op_index++;
         if(op_index == trace->num_ops) break;
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
+    if (tracefile != NULL) {
+        fclose(tracefile);
+        assert(max_index == trace->num_ids - 1);
+        assert(trace->num_ops == op_index);
+    }
 
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
@@ -825,12 +1498,16 @@ static void reinit_trace(trace_t *trace)
 
 /*
  * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated (or, for the ops of a
+ *              binary trace, mapped) in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);
+    if (trace->map.map != NULL)
+        tf_unmap(&trace->map);    /* unmap a binary trace... */
+    else
+        free(trace->ops);         /* ...or free the ops array */
+    free(trace->blocks);          /* free the other three arrays... */
     free(trace->block_sizes);
     free(trace->block_rand_base);
     free(trace);              /* and the trace record itself... */
@@ -853,13 +1530,13 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
     char *oldp;
     char *p;
 
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
     reinit_trace(trace);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (mm_funcs->init() < 0) {
         malloc_error(trace, 0, "mm_init failed.");
         return 0;
     }
@@ -870,17 +1547,11 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         size = trace->ops[i].size;
 
         if(debug_mode == DBG_EXPENSIVE) {
-            range_t *r;
-                        
             /* Let the students check their own heap */
-            mm_checkheap(verbose);
+            mm_funcs->checkheap(verbose);
 
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
-            while(r) {
-                check_index(trace, i, r->index);
-                r = r->next;
-            }
+            check_ranges(trace, i, *ranges);
         }
 
         switch (trace->ops[i].type) {
@@ -888,14 +1559,14 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = mm_funcs->malloc(size)) == NULL) {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return 0;
             }
 
             /*
              * Test the range of the new block for correctness and add it
-             * to the range list if OK. The block must be  be aligned properly,
+             * to the range tree if OK. The block must be  be aligned properly,
              * and must not overlap any currently allocated block.
              */
             if (add_range(ranges, p, size, trace, i, index) == 0)
@@ -914,7 +1585,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
 
             /* Call the student's realloc */
             oldp = trace->blocks[index];
-            newp = mm_realloc(oldp, size);
+            newp = mm_funcs->realloc(oldp, size);
             if( (newp == NULL) && (size != 0) ) {
                 malloc_error(trace, i, "mm_realloc failed.");
                 return 0;
@@ -926,10 +1597,10 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             }
 
 
-            /* Remove the old region from the range list */
+            /* Remove the old region from the range tree */
             remove_range(ranges, oldp);
 
-            /* Check new block for correctness and add it to range list */
+            /* Check new block for correctness and add it to range tree */
             if (size > 0) {
                 if(add_range(ranges, newp, size, trace, i, index) == 0)
                     return 0;
@@ -959,7 +1630,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            mm_funcs->free(p);
             break;
 
         default:
@@ -972,6 +1643,20 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
     return 1;
 }
 
+/*
+ * touch_pages - Write a byte on every page of [p, p+len), standing in
+ *   for a program using its blocks, so that with --rss the live data
+ *   is resident and not just the allocator's headers and links
+ */
+static void touch_pages(char *p, size_t len)
+{
+    uintptr_t page = mem_pagesize();
+    char *end = p + len;
+
+    for (; p < end; p = (char *)(((uintptr_t)p | (page - 1)) + 1))
+        *(volatile char *)p = 0;
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
@@ -998,7 +1683,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (mm_funcs->init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -1008,11 +1693,14 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = mm_funcs->malloc(size)) == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
 
+            if (rss_flag)
+                touch_pages(p, size);
+
             /* Remember region and size */
             trace->blocks[index] = p;
             trace->block_sizes[index] = size;
@@ -1026,11 +1714,14 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             oldsize = trace->block_sizes[index];
 
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
+            if ((newp = mm_funcs->realloc(oldp,newsize)) == NULL && newsize != 0) {
                 app_error("trace %d: mm_realloc failed in eval_mm_util",
                           tracenum);
             }
 
+            if (rss_flag && newsize > oldsize)
+                touch_pages(newp + oldsize, newsize - oldsize);
+
             /* Remember region and size */
             trace->blocks[index] = newp;
             trace->block_sizes[index] = newsize;
@@ -1048,7 +1739,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
-            mm_free(p);
+            mm_funcs->free(p);
 
             total_size -= size;
             break;
@@ -1068,6 +1759,85 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
+/*
+ * timeline_sample - Write one footprint sample, after request opnum
+ */
+static void timeline_sample(const trace_t *trace, int opnum, size_t live)
+{
+    mm_footprint_t fp;
+    int c;
+
+    mm_funcs->footprint(&fp);
+    fprintf(timeline, "%s,%d,%lu,%lu,%lu,%lu", trace->filename, opnum,
+            (unsigned long)live, (unsigned long)mem_heapsize(),
+            (unsigned long)fp.free_bytes, (unsigned long)fp.largest_free);
+    for (c = 0; c < MM_FP_CLASSES; c++)
+        fprintf(timeline, ",%lu",
+                c < fp.nclasses ? (unsigned long)fp.class_free[c] : 0UL);
+    fprintf(timeline, "\n");
+}
+
+/*
+ * eval_mm_timeline - Replay the trace, and sample the live payload
+ *     bytes, the heap size and the allocator's free space after every
+ *     timeline_interval requests (and after the last one), so you can
+ *     see where in the trace the heap fragments. eval_mm_util reports
+ *     only the end result of the same replay.
+ */
+static void eval_mm_timeline(trace_t *trace, int tracenum)
+{
+    int i, index;
+    size_t live = 0;
+    char *p;
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_funcs->init() < 0)
+        app_error("trace %d: mm_init failed in eval_mm_timeline", tracenum);
+    timeline_sample(trace, 0, live);
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_alloc */
+            if ((p = mm_funcs->malloc(trace->ops[i].size)) == NULL)
+                app_error("trace %d: mm_malloc failed in eval_mm_timeline",
+                          tracenum);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = trace->ops[i].size;
+            live += trace->ops[i].size;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            p = mm_funcs->realloc(trace->blocks[index], trace->ops[i].size);
+            if (p == NULL && trace->ops[i].size != 0)
+                app_error("trace %d: mm_realloc failed in eval_mm_timeline",
+                          tracenum);
+            live += trace->ops[i].size - trace->block_sizes[index];
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = trace->ops[i].size;
+            break;
+
+        case FREE: /* mm_free */
+            if (index < 0) {
+                mm_funcs->free(NULL);
+            } else {
+                mm_funcs->free(trace->blocks[index]);
+                live -= trace->block_sizes[index];
+            }
+            break;
+
+        default:
+            app_error("trace %d: Nonexistent request type in eval_mm_timeline",
+                      tracenum);
+        }
+
+        if ((i + 1) % timeline_interval == 0 || i + 1 == trace->num_ops)
+            timeline_sample(trace, i + 1, live);
+    }
+}
+
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
@@ -1082,7 +1852,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (mm_funcs->init() < 0)
         app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -1092,7 +1862,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm_funcs->malloc(size)) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -1101,7 +1871,7 @@ static void eval_mm_speed(void *ptr)
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+            if ((newp = mm_funcs->realloc(oldp,newsize)) == NULL && newsize != 0)
                 app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -1113,7 +1883,7 @@ static void eval_mm_speed(void *ptr)
             } else {
                 block = trace->blocks[index];
             }
-            mm_free(block);
+            mm_funcs->free(block);
             break;
 
         default:
@@ -1122,106 +1892,780 @@ static void eval_mm_speed(void *ptr)
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_latency - Replay the trace once more, reading the cycle
+ *    counter around every call of the mm package, and record each
+ *    call's cycles in the histogram for its request type (hist is
+ *    indexed by ALLOC, FREE and REALLOC). The cost of reading the
+ *    counter itself is measured once and subtracted.
  */
-static int eval_libc_valid(trace_t *trace)
+static void eval_mm_latency(trace_t *trace, lathist_t *hist)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    static unsigned long long ovhd = ~0ULL;
+    unsigned long long start, cyc;
+    int i, index;
+    size_t size;
+    char *p;
+
+    /* Cheapest back-to-back counter read */
+    if (ovhd == ~0ULL) {
+        for (i = 0; i < 1000; i++) {
+            start = read_counter();
+            cyc = read_counter() - start;
+            ovhd = cyc < ovhd ? cyc : ovhd;
+        }
+    }
 
+    for (i = 0; i < 3; i++)
+        lh_reset(&hist[i]);
     reinit_trace(trace);
+    mem_reset_brk();
+    if (mm_funcs->init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
 
-        case ALLOC: /* malloc */
-            if ((p = malloc(trace->ops[i].size)) == NULL) {
-                malloc_error(trace, i, "libc malloc failed");
-                unix_error("System message");
-            }
-            trace->blocks[trace->ops[i].index] = p;
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+            start = read_counter();
+            p = mm_funcs->malloc(size);
+            cyc = read_counter() - start;
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
             break;
 
-        case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[trace->ops[i].index];
-            if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0) {
-                malloc_error(trace, i, "libc realloc failed");
-                unix_error("System message");
-            }
-            trace->blocks[trace->ops[i].index] = newp;
+        case REALLOC: /* mm_realloc */
+            start = read_counter();
+            p = mm_funcs->realloc(trace->blocks[index], size);
+            cyc = read_counter() - start;
+            if (p == NULL && size != 0)
+                app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
             break;
 
-        case FREE: /* free */
-            if(trace->ops[i].index >= 0) {
-                free(trace->blocks[trace->ops[i].index]);
-            } else {
-                free(0);
-            }
+        case FREE: /* mm_free */
+            p = (index < 0) ? NULL : trace->blocks[index];
+            start = read_counter();
+            mm_funcs->free(p);
+            cyc = read_counter() - start;
             break;
 
         default:
-            app_error("invalid operation type  in eval_libc_valid");
+            app_error("Nonexistent request type in eval_mm_latency");
         }
+        lh_record(&hist[trace->ops[i].type], cyc > ovhd ? cyc - ovhd : 0);
     }
+}
 
-    return 1;
+/*
+ * print_latency - Print the latency percentiles of each request type
+ */
+static void print_latency(FILE *out, const char *filename,
+                          const lathist_t *hist)
+{
+    static const char *names[3] = { "malloc", "free", "realloc" };
+    int t;
+
+    fprintf(out, "\nLatency in cycles for %s:\n", filename);
+    fprintf(out, "  %-8s %8s %8s %8s %8s %8s %10s\n",
+            "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (t = 0; t < 3; t++) {
+        if (hist[t].total == 0)
+            continue;
+        fprintf(out, "  %-8s %8lu %8lu %8lu %8lu %8lu %10lu\n", names[t],
+                (unsigned long)hist[t].total,
+                (unsigned long)lh_percentile(&hist[t], 50),
+                (unsigned long)lh_percentile(&hist[t], 90),
+                (unsigned long)lh_percentile(&hist[t], 99),
+                (unsigned long)lh_percentile(&hist[t], 99.9),
+                (unsigned long)hist[t].max);
+    }
 }
 
 /*
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+ * eval_mm_counters - Count the hardware events of one more replay of
+ *     the trace, after the timing runs, so the counters never perturb
+ *     the timings and the caches are as warm as fsecs left them.
  */
-static void eval_libc_speed(void *ptr)
+static void eval_mm_counters(speed_t *speed_params)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    pc_reset(&perfctr);
+    pc_start(&perfctr);
+    eval_mm_speed(speed_params);
+    pc_stop(&perfctr);
+}
 
+/*
+ * eval_mm_profile - Profile one more replay of the trace with the
+ *     profiled build of mm.c, which the timing runs never use
+ */
+static void eval_mm_profile(speed_t *speed_params, mm_profile_t *prof)
+{
+    const backend_t *timed = mm_funcs;
+
+    mm_funcs = find_backend("prof");
+    eval_mm_speed(speed_params);
+    mm_funcs->profile(prof);
+    mm_funcs = timed;
+}
+
+/* sim_access - The memlib access hook of eval_mm_sim */
+static void sim_access(const void *p, size_t len, int payload)
+{
+    cs_access(&cachesim, (uintptr_t)p, len, payload ? CS_PAYLOAD : CS_META);
+}
+
+/*
+ * eval_mm_sim - Replay the trace with the build of mm.c that reports
+ *     its heap accesses (-DMM_SIMULATE), feeding them to the cache
+ *     and TLB simulator. The driver stands in for a program using the
+ *     blocks: it writes every new payload, and the new tail of a
+ *     block grown by realloc.
+ */
+static void eval_mm_sim(trace_t *trace)
+{
+    const backend_t *timed = mm_funcs;
+    int i, index, size, oldsize;
+    char *p;
+
+    mm_funcs = find_backend("sim");
+    cs_reset(&cachesim);
     reinit_trace(trace);
+    mem_reset_brk();
+    mem_set_access_hook(sim_access);
+    if (mm_funcs->init() < 0)
+        app_error("mm_init failed in eval_mm_sim");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = malloc(size)) == NULL)
-                unix_error("malloc failed in eval_libc_speed");
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_funcs->malloc(size)) == NULL)
+                app_error("mm_malloc error in eval_mm_sim");
+            mem_access(p, size, 1);
             trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
             break;
 
-        case REALLOC: /* realloc */
-            index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-            oldp = trace->blocks[index];
-            if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
-                unix_error("realloc failed in eval_libc_speed\n");
+        case REALLOC: /* mm_realloc */
+            oldsize = trace->blocks[index] ? trace->block_sizes[index] : 0;
+            p = mm_funcs->realloc(trace->blocks[index], size);
+            if (p == NULL && size != 0)
+                app_error("mm_realloc error in eval_mm_sim");
+            if (size > oldsize)
+                mem_access(p + oldsize, size - oldsize, 1);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
 
-            trace->blocks[index] = newp;
+        case FREE: /* mm_free */
+            mm_funcs->free(index < 0 ? NULL : trace->blocks[index]);
             break;
+        }
+    }
+    mem_set_access_hook(NULL);
+    mm_funcs = timed;
+}
 
-        case FREE: /* free */
-            index = trace->ops[i].index;
-            if(index >= 0) {
-                block = trace->blocks[index];
-                free(block);
-            } else {
-                free(0);
+/*
+ * print_sim - Print the accesses and misses of the last eval_mm_sim,
+ *     for the allocator's metadata and the payloads apart
+ */
+static void print_sim(FILE *out, const char *filename, int ops)
+{
+    const char *levels[] = { "L1", "L2", "TLB" };
+    const cs_cache_t *c[] = { &cachesim.l1, &cachesim.l2, &cachesim.tlb };
+    char desc[MAXLINE];
+    int l, k;
+
+    cs_describe(&cachesim, desc, sizeof(desc));
+    fprintf(out, "\nSimulated caches for %s (%s):\n", filename, desc);
+    fprintf(out, "  %-4s %-8s %12s %10s %8s %10s\n", "", "access",
+            "lookups", "misses", "rate", "miss/op");
+    for (l = 0; l < 3; l++) {
+        if (c[l]->size == 0)
+            continue;
+        for (k = 0; k < CS_KINDS; k++) {
+            uint64_t n = c[l]->accesses[k], m = c[l]->misses[k];
+            fprintf(out, "  %-4s %-8s %12lu %10lu %7.2f%% %10.3f\n",
+                    k == 0 ? levels[l] : "", k == CS_META ? "metadata" : "payload",
+                    (unsigned long)n, (unsigned long)m,
+                    n > 0 ? 100.0 * m / n : 0.0,
+                    ops > 0 ? (double)m / ops : 0.0);
+        }
+    }
+}
+
+/*
+ * print_profile - Print the calls and self cycles of each phase of
+ *     mm.c, and the free blocks probed per search and per insert
+ */
+static void print_profile(FILE *out, const char *filename, int ops,
+                          const mm_profile_t *prof)
+{
+    static const char *names[MM_PROF_PHASES] = MM_PROF_NAMES;
+    unsigned long long total = 0;
+    int p;
+
+    for (p = 0; p < MM_PROF_PHASES; p++)
+        total += prof->cycles[p];
+    fprintf(out, "\nProfile of mm.c for %s (%.0f cycles per op):\n", filename,
+            ops > 0 ? (double)total / ops : 0.0);
+    fprintf(out, "  %-12s %10s %14s %10s %6s\n", "phase", "calls", "self cycles",
+            "per call", "share");
+    for (p = 0; p < MM_PROF_PHASES; p++) {
+        if (prof->calls[p] == 0)
+            continue;
+        fprintf(out, "  %-12s %10lu %14llu %10.1f %5.1f%%\n", names[p],
+                prof->calls[p], prof->cycles[p],
+                (double)prof->cycles[p] / prof->calls[p],
+                total > 0 ? 100.0 * prof->cycles[p] / total : 0.0);
+    }
+    fprintf(out, "  %.2f free blocks probed per find_fit, %.2f passed per insert\n",
+            prof->calls[MM_PROF_FIND_FIT] > 0 ? (double)prof->fit_probes /
+            prof->calls[MM_PROF_FIND_FIT] : 0.0,
+            prof->calls[MM_PROF_INSERT] > 0 ? (double)prof->insert_probes /
+            prof->calls[MM_PROF_INSERT] : 0.0);
+}
+
+/*
+ * print_counters - Print the counts of the last eval_mm_counters, in
+ *     total and per request
+ */
+static void print_counters(FILE *out, const char *filename, int ops)
+{
+    int e;
+
+    fprintf(out, "\nHardware counters for %s:\n", filename);
+    fprintf(out, "  %-14s %14s %10s\n", "event", "count", "per op");
+    for (e = 0; e < PC_NUM; e++) {
+        if (perfctr.fd[e] < 0)
+            fprintf(out, "  %-14s %14s %10s\n", pc_names[e], "--", "--");
+        else
+            fprintf(out, "  %-14s %14lu %10.2f\n", pc_names[e],
+                    (unsigned long)perfctr.value[e],
+                    ops > 0 ? (double)perfctr.value[e] / ops : 0.0);
+    }
+    if (perfctr.fd[PC_CYCLES] >= 0 && perfctr.fd[PC_INSTRUCTIONS] >= 0 &&
+        perfctr.value[PC_CYCLES] > 0)
+        fprintf(out, "  %-14s %14.2f\n", "IPC",
+                (double)perfctr.value[PC_INSTRUCTIONS] / perfctr.value[PC_CYCLES]);
+}
+
+/*
+ * differs - With --samples, '+' if a's throughput is above b's by more
+ *    than the two confidence intervals allow, '-' if below, else ' '
+ */
+static char differs(const stats_t *a, const stats_t *b)
+{
+    double alo, ahi, blo, bhi;
+
+    if (!robust_samples || !a->valid || !b->valid)
+        return ' ';
+    kops_interval(a, &alo, &ahi);
+    kops_interval(b, &blo, &bhi);
+    if (alo > bhi)
+        return '+';
+    if (ahi < blo)
+        return '-';
+    return ' ';
+}
+
+/*
+ * run_backends - Run the same traces against each of the nb backends
+ *    in b[], under the same conditions, leaving the results of b[k] in
+ *    stats[k], and print the results side by side.
+ */
+static void run_backends(int nb, const backend_t **b, stats_t **stats,
+                         int njobs, int num_tracefiles, const char *tracedir,
+                         char **tracefiles, range_t *ranges,
+                         speed_t *speed_params)
+{
+    int i, k;
+    double util, thru;
+
+    for (k = 0; k < nb; k++) {
+        if (verbose > 1)
+            printf("\nTesting %s\n", b[k]->desc);
+
+        stats[k] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+        if (stats[k] == NULL)
+            unix_error("stats calloc in run_backends failed");
+
+        mm_funcs = b[k];
+        if (njobs > 1)
+            run_parallel(njobs, num_tracefiles, tracedir, tracefiles,
+                         stats[k], ranges, speed_params);
+        else
+            run_tests(num_tracefiles, tracedir, tracefiles, stats[k],
+                      ranges, speed_params);
+
+        if (verbose > 1) {
+            printf("\nResults for %s:\n", b[k]->desc);
+            printresults(num_tracefiles, stats[k]);
+        }
+    }
+    mm_funcs = &backends[0];
+
+    /* One util and Kops column pair per backend */
+    printf("\n%-20s", "");
+    for (k = 0; k < nb; k++)
+        printf(" %16s", b[k]->name);
+    printf("\n%-20s", "trace");
+    for (k = 0; k < nb; k++)
+        printf(" %6s %9s", "util", "Kops");
+    printf("\n");
+    for (i = 0; i < num_tracefiles; i++) {
+        printf("%-20.20s", tracefiles[i]);
+        for (k = 0; k < nb; k++) {
+            if (!stats[k][i].valid) {
+                printf(" %6s %9s", "--", "--");
+                continue;
             }
+            if (!b[k]->memlib)
+                printf(" %6s", "--");
+            else
+                printf(" %5.0f%%", stats[k][i].util * 100.0);
+            printf(" %8.0f%c", stats[k][i].ops / 1e3 / stats[k][i].secs,
+                   k > 0 ? differs(&stats[k][i], &stats[0][i]) : ' ');
+        }
+        printf("\n");
+    }
+    printf("%-20s", "average");
+    for (k = 0; k < nb; k++) {
+        average_stats(num_tracefiles, stats[k], &util, &thru);
+        if (!b[k]->memlib)
+            printf(" %6s %9.0f", "--", thru / 1e3);
+        else
+            printf(" %5.1f%% %9.0f", util * 100.0, thru / 1e3);
+    }
+    printf("\n");
+    if (robust_samples && nb > 1)
+        printf("+/-: faster/slower than %s, beyond the 95%% confidence "
+               "intervals\n", b[0]->name);
+}
+
+/*
+ * parse_backends - Look up the comma-separated backend names in list
+ *    ("all" for every backend), and return how many there are
+ */
+static int parse_backends(const char *list, const backend_t **b)
+{
+    char *names, *name, *save;
+    int n = 0;
+
+    if (!strcmp(list, "all")) {
+        for (n = 0; n < num_backends; n++)
+            b[n] = &backends[n];
+        return n;
+    }
+    if ((names = strdup(list)) == NULL)
+        unix_error("strdup failed in parse_backends");
+    for (name = strtok_r(names, ",", &save); name != NULL;
+         name = strtok_r(NULL, ",", &save)) {
+        if (n == num_backends)
+            app_error("Too many backends in -b %s\n", list);
+        if ((b[n++] = find_backend(name)) == NULL)
+            app_error("Unknown backend %s (try -h)\n", name);
+    }
+    free(names);
+    if (n == 0)
+        app_error("-b needs at least one backend\n");
+    return n;
+}
+
+/*
+ * run_fit_policies - Run the traces against each fit policy build of
+ *    mm.c and print where each one lands on the util/throughput
+ *    frontier. A policy is on the frontier if no other policy has both
+ *    higher utilization and higher throughput.
+ */
+static void run_fit_policies(int njobs, int num_tracefiles,
+                             const char *tracedir, char **tracefiles,
+                             range_t *ranges, speed_t *speed_params)
+{
+    static const char *names[] = { "first", "best", "bounded", "next" };
+    enum { NUM_FIT_POLICIES = sizeof(names) / sizeof(names[0]) };
+    const backend_t *b[NUM_FIT_POLICIES];
+    stats_t *stats[NUM_FIT_POLICIES];
+    double util[NUM_FIT_POLICIES], thru[NUM_FIT_POLICIES];
+    int p, q;
+
+    for (p = 0; p < NUM_FIT_POLICIES; p++)
+        b[p] = find_backend(names[p]);
+    run_backends(NUM_FIT_POLICIES, b, stats, njobs, num_tracefiles,
+                 tracedir, tracefiles, ranges, speed_params);
+    for (p = 0; p < NUM_FIT_POLICIES; p++) {
+        average_stats(num_tracefiles, stats[p], &util[p], &thru[p]);
+        free(stats[p]);
+    }
+
+    printf("\nFit policy frontier:\n");
+    printf("  %-8s %6s %9s  %s\n", "policy", "util", "Kops", "frontier");
+    for (p = 0; p < NUM_FIT_POLICIES; p++) {
+        int dominated = 0;
+        for (q = 0; q < NUM_FIT_POLICIES; q++) {
+            if (q != p && util[q] >= util[p] && thru[q] >= thru[p] &&
+                (util[q] > util[p] || thru[q] > thru[p]))
+                dominated = 1;
+        }
+        printf("  %-8s %5.1f%% %9.0f  %s\n", names[p],
+               util[p] * 100.0, thru[p] / 1e3, dominated ? "" : "*");
+    }
+}
+
+/*
+ * replay_trace - Replay a trace against the mm package without any
+ *    checking. Unlike eval_mm_speed, this does not reset the heap, so
+ *    several threads can replay into the same heap. Returns 0 if an
+ *    allocation failed.
+ */
+static int replay_trace(trace_t *trace)
+{
+    int i, index;
+    size_t size;
+    char *p;
+
+    reinit_trace(trace);
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_funcs->malloc(size)) == NULL)
+                return 0;
+            trace->blocks[index] = p;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            p = mm_funcs->realloc(trace->blocks[index], size);
+            if (p == NULL && size != 0)
+                return 0;
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+            mm_funcs->free(index < 0 ? NULL : trace->blocks[index]);
             break;
         }
     }
+    return 1;
+}
+
+/* wall_secs - Monotonic wall clock time in secs */
+static double wall_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* replay_body - One replay by a -T thread, between wall clock times */
+static void replay_body(void *arg)
+{
+    replay_t *r = (replay_t *)arg;
+
+    r->start = wall_secs();
+    r->failed = !replay_trace(r->trace);
+    r->end = wall_secs();
+}
+
+/*
+ * replay_thread - Body of one -T thread; times its own replay. With a
+ *    cycle or clock timer the replay is one sample on a measurement
+ *    context of the thread's own; otherwise it is timed by the wall
+ *    clock.
+ */
+static void *replay_thread(void *arg)
+{
+    replay_t *r = (replay_t *)arg;
+    double mhz = fsecs_mhz();
+    fcyc_ctx_t ctx;
+
+    fcyc_ctx_init(&ctx);
+    ctx.kbest = 1;
+    ctx.maxsamples = 1;
+
+    pthread_barrier_wait(r->ready);
+    if (mhz > 0) {
+        r->secs = fcyc_r(&ctx, replay_body, r) / (mhz * 1e6);
+    } else {
+        replay_body(r);
+        r->secs = r->end - r->start;
+    }
+    fcyc_ctx_free(&ctx);
+    return NULL;
+}
+
+/*
+ * run_replay - Replay r[0..nthreads-1] concurrently on a fresh heap,
+ *    MT_REPS times. The wall-clock time of a run is from the first
+ *    thread starting its replay to the last one finishing, so thread
+ *    creation and joins are not counted. Returns the best such time,
+ *    and leaves the per-thread times of that run in r[]. Returns -1 if
+ *    any thread ran out of memory.
+ */
+static double run_replay(replay_t *r, int nthreads)
+{
+    int rep, t;
+    double start, end, secs, best = DBL_MAX;
+    double *best_secs;
+    pthread_t *tids;
+    pthread_barrier_t barrier;
+
+    tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    best_secs = (double *)malloc(nthreads * sizeof(double));
+    if (tids == NULL || best_secs == NULL)
+        unix_error("malloc failed in run_replay");
+
+    for (rep = 0; rep < MT_REPS; rep++) {
+        mem_reset_brk();
+        if (mm_funcs->init() < 0)
+            app_error("mm_init failed in run_replay");
+
+        pthread_barrier_init(&barrier, NULL, nthreads + 1);
+        for (t = 0; t < nthreads; t++) {
+            r[t].ready = &barrier;
+            if (pthread_create(&tids[t], NULL, replay_thread, &r[t]) != 0)
+                unix_error("pthread_create failed in run_replay");
+        }
+        pthread_barrier_wait(&barrier);
+        for (t = 0; t < nthreads; t++)
+            pthread_join(tids[t], NULL);
+        pthread_barrier_destroy(&barrier);
+
+        start = DBL_MAX;
+        end = 0;
+        for (t = 0; t < nthreads; t++) {
+            if (r[t].failed) {
+                best = -1;
+                goto done;
+            }
+            start = r[t].start < start ? r[t].start : start;
+            end = r[t].end > end ? r[t].end : end;
+        }
+        secs = end - start;
+        if (secs < best) {
+            best = secs;
+            for (t = 0; t < nthreads; t++)
+                best_secs[t] = r[t].secs;
+        }
+    }
+    for (t = 0; t < nthreads; t++)
+        r[t].secs = best_secs[t];
+
+ done:
+    free(tids);
+    free(best_secs);
+    return best;
+}
+
+/*
+ * run_threads - Replay each trace on nthreads threads at once against
+ *    the thread-safe build of mm.c, each thread with its own copy of
+ *    the trace (and so its own index space). With mixed set, thread t
+ *    replays the trace t places further down the list instead.
+ *
+ *    Reports aggregate and per-thread throughput, and the scaling
+ *    efficiency: aggregate throughput over nthreads times the
+ *    throughput of replaying the same traces one at a time on a
+ *    single thread. 100% is perfect scaling.
+ */
+static void run_threads(int nthreads, int mixed, int num_tracefiles,
+                        const char *tracedir, char **tracefiles,
+                        range_t *ranges)
+{
+    int i, t, ndistinct;
+    double ops, secs, secs1, agg, agg1, kops, min_kops, max_kops;
+    double sum_ops = 0, sum_secs = 0, sum_secs1 = 0;
+    double *single;
+    replay_t *r;
+    stats_t stats;
+
+    mm_funcs = find_backend("mt");
+    r = (replay_t *)calloc(nthreads, sizeof(replay_t));
+    single = (double *)calloc(nthreads, sizeof(double));
+    if (r == NULL || single == NULL)
+        unix_error("calloc failed in run_threads");
+
+    /* Threads t and t+ndistinct replay the same trace */
+    ndistinct = 1;
+    if (mixed)
+        ndistinct = nthreads < num_tracefiles ? nthreads : num_tracefiles;
+
+    printf("\nMulti-threaded replay, %d threads (%s traces):\n",
+           nthreads, mixed ? "mixed" : "same");
+    printf("  %5s %10s %10s %10s %10s %6s  %s\n", "valid", "1-thr Kops",
+           "agg Kops", "min Kops", "max Kops", "eff", "trace");
+
+    for (i = 0; i < num_tracefiles; i++) {
+        int valid = 1;
+
+        /* start each trace with a clean memory system */
+        mem_init();
+
+        for (t = 0; t < nthreads; t++) {
+            int n = mixed ? (i + t) % num_tracefiles : i;
+            r[t].trace = read_trace(&stats, tracedir, tracefiles[n]);
+        }
+
+        /* Check each distinct trace once, on a single thread */
+        for (t = 0; t < ndistinct && valid; t++) {
+            if (verbose > 1)
+                printf("Checking %s for correctness\n", r[t].trace->filename);
+            valid = eval_mm_valid(r[t].trace, &ranges);
+        }
+
+        /* Single-thread baseline, then all threads at once */
+        secs1 = 0;
+        secs = -1;
+        for (t = 0; t < ndistinct && valid; t++) {
+            single[t] = run_replay(&r[t], 1);
+            if (single[t] < 0)
+                valid = 0;
+        }
+        if (valid) {
+            for (t = 0; t < nthreads; t++)
+                secs1 += single[t % ndistinct];
+            secs = run_replay(r, nthreads);
+        }
+
+        if (!valid || secs < 0) {
+            printf("  %5s %10s %10s %10s %10s %6s  %s%s\n", "no", "-", "-",
+                   "-", "-", "-", r[0].trace->filename,
+                   valid ? " (out of memory)" : "");
+        } else {
+            ops = 0;
+            min_kops = DBL_MAX;
+            max_kops = 0;
+            for (t = 0; t < nthreads; t++) {
+                ops += r[t].trace->num_ops;
+                kops = (r[t].trace->num_ops / 1e3) / r[t].secs;
+                min_kops = kops < min_kops ? kops : min_kops;
+                max_kops = kops > max_kops ? kops : max_kops;
+                if (verbose > 1)
+                    printf("    thread %d: %.0f Kops %s\n", t, kops,
+                           r[t].trace->filename);
+            }
+            agg = ops / secs;
+            agg1 = ops / secs1;
+            printf("  %5s %10.0f %10.0f %10.0f %10.0f %5.0f%%  %s\n", "yes",
+                   agg1 / 1e3, agg / 1e3, min_kops, max_kops,
+                   agg / (nthreads * agg1) * 100.0, r[0].trace->filename);
+            sum_ops += ops;
+            sum_secs += secs;
+            sum_secs1 += secs1;
+        }
+
+        for (t = 0; t < nthreads; t++)
+            free_trace(r[t].trace);
+        mem_deinit();
+    }
+
+    if (sum_secs > 0) {
+        agg = sum_ops / sum_secs;
+        agg1 = sum_ops / sum_secs1;
+        printf("  %5s %10.0f %10.0f %10s %10s %5.0f%%\n", "total",
+               agg1 / 1e3, agg / 1e3, "", "",
+               agg / (nthreads * agg1) * 100.0);
+    }
+
+    free(r);
+    free(single);
+    mm_funcs = &backends[0];
 }
 
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
 
+/*
+ * check_mem_ctx - Check that memlib's heap contexts are independent:
+ *    two builds of mm.c, each on a heap of its own, take turns at
+ *    allocating and freeing, switching heaps before every call. Every
+ *    block must lie in its own allocator's heap and keep its data.
+ */
+#define CTX_BLOCKS 64
+static void check_mem_ctx(void)
+{
+    const backend_t *b[2] = { find_backend("first"), find_backend("best") };
+    mem_ctx_t *ctx[2], *old;
+    char *p[2][CTX_BLOCKS];
+    int i, k, size;
+
+    for (k = 0; k < 2; k++)
+        if ((ctx[k] = mem_ctx_create(1 << 20)) == NULL)
+            unix_error("mem_ctx_create failed in check_mem_ctx");
+    old = mem_set_ctx(NULL);
+    for (k = 0; k < 2; k++) {
+        mem_set_ctx(ctx[k]);
+        if (b[k]->init() < 0)
+            app_error("mm_init failed in check_mem_ctx");
+    }
+
+    for (i = 0; i < CTX_BLOCKS; i++) {
+        for (k = 0; k < 2; k++) {
+            size = 8 * i + 24 * k + 1;
+            mem_set_ctx(ctx[k]);
+            if ((p[k][i] = b[k]->malloc(size)) == NULL)
+                app_error("mm_malloc failed in check_mem_ctx");
+            if (p[k][i] < (char *)mem_ctx_heap_lo(ctx[k]) ||
+                p[k][i] + size - 1 > (char *)mem_ctx_heap_hi(ctx[k]))
+                app_error("check_mem_ctx: block outside its heap");
+            memset(p[k][i], i + k, size);
+        }
+        if (i % 2 == 0)
+            continue;
+        for (k = 0; k < 2; k++) {
+            mem_set_ctx(ctx[k]);
+            b[k]->free(p[k][i - 1]);
+            p[k][i - 1] = NULL;
+        }
+    }
+
+    for (k = 0; k < 2; k++) {
+        for (i = 0; i < CTX_BLOCKS; i++) {
+            size = 8 * i + 24 * k + 1;
+            while (p[k][i] != NULL && size-- > 0)
+                if (p[k][i][size] != (char)(i + k))
+                    app_error("check_mem_ctx: heap %d lost its data", k);
+        }
+        mem_set_ctx(NULL);
+        mem_ctx_destroy(ctx[k]);
+    }
+    mem_set_ctx(old);
+}
+
+/*
+ * average_stats - Average util and overall throughput of the traces
+ *    that ran correctly. Unlike the performance index, trace weights
+ *    are ignored, so unweighted benchmark traces count as well.
+ */
+static void average_stats(int n, const stats_t *stats,
+                          double *avg_util, double *avg_throughput)
+{
+    int i;
+    double secs = 0, ops = 0, util = 0;
+    int nvalid = 0;
+
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        secs += stats[i].secs;
+        ops += stats[i].ops;
+        util += stats[i].util;
+        nvalid++;
+    }
+    *avg_util = (nvalid == 0) ? 0 : util / nvalid;
+    *avg_throughput = (secs == 0) ? 0 : ops / secs;
+}
+
 
 /*
  * printresults - prints a performance summary for some malloc package
@@ -1330,6 +2774,407 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * kops_interval - The confidence interval of a trace's throughput,
+ *     in Kops, from the interval of its running time
+ */
+static void kops_interval(const stats_t *st, double *lo, double *hi)
+{
+    *lo = st->secs_hi > 0 ? st->ops / 1e3 / st->secs_hi : 0;
+    *hi = st->secs_lo > 0 ? st->ops / 1e3 / st->secs_lo : 0;
+}
+
+/*
+ * print_robust - Print the throughput of each trace as the median and
+ *     half the width of its 95% confidence interval (--samples)
+ */
+static void print_robust(int n, const stats_t *stats)
+{
+    double lo, hi;
+    int i;
+
+    printf("Throughput, median of the samples with a 95%% confidence interval:\n");
+    printf("  %17s %12s  %s\n", "Kops", "samples", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        kops_interval(&stats[i], &lo, &hi);
+        printf("  %8.0f \u00b1 %-6.0f %5d/%-6d  %s\n",
+               stats[i].ops / 1e3 / stats[i].secs, (hi - lo) / 2,
+               stats[i].kept, stats[i].samples, stats[i].filename);
+    }
+}
+
+/*
+ * print_cold - Print the throughput of each trace with warm caches and
+ *     with the caches flushed before every run (--cold). With
+ *     --samples both are medians, with their confidence intervals.
+ */
+static void print_cold(int n, const stats_t *stats)
+{
+    double warm, cold, lo, hi;
+    stats_t st;
+    long llc;
+    int i;
+
+    fcyc_cache_sizes(NULL, NULL, &llc, NULL);
+    printf("Throughput with warm and cold caches (%ldKB LLC flushed%s):\n",
+           llc >> 10, fcyc_flush(NULL, 0) ? ", heap clflushed" : "");
+    if (robust_samples)
+        printf("  %17s %17s %6s  %s\n", "warm Kops", "cold Kops", "cold",
+               "trace");
+    else
+        printf("  %9s %9s %6s  %s\n", "warm Kops", "cold Kops", "cold",
+               "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        warm = stats[i].ops / 1e3 / stats[i].secs;
+        cold = stats[i].cold_secs > 0 ? stats[i].ops / 1e3 / stats[i].cold_secs : 0;
+        if (robust_samples) {
+            kops_interval(&stats[i], &lo, &hi);
+            printf("  %8.0f \u00b1 %-6.0f", warm, (hi - lo) / 2);
+            st = stats[i];
+            st.secs_lo = st.cold_lo;
+            st.secs_hi = st.cold_hi;
+            kops_interval(&st, &lo, &hi);
+            printf(" %8.0f \u00b1 %-6.0f", cold, (hi - lo) / 2);
+        } else {
+            printf("  %9.0f %9.0f", warm, cold);
+        }
+        printf(" %5.0f%%  %s\n", warm > 0 ? cold / warm * 100 : 0,
+               stats[i].filename);
+    }
+}
+
+/*
+ * print_rss - Print the page faults and resident memory of each
+ *     trace's util run, and the utilization measured against the
+ *     resident pages of the heap instead of its size (--rss)
+ */
+static void print_rss(int n, const stats_t *stats)
+{
+    double util = 0, rss_util = 0;
+    int i, nvalid = 0;
+
+    printf("Resident memory of the heap:\n");
+    printf("  %8s %9s %9s %5s %6s %8s %10s  %s\n", "minflt", "heap KB",
+           "resid KB", "resid", "util", "rss util", "peak RSS", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("  %8ld %9zu %9zu %4.0f%% %5.0f%% %7.0f%% %8ldKB  %s\n",
+               stats[i].minflt, stats[i].heap_bytes >> 10,
+               stats[i].resident_bytes >> 10,
+               stats[i].heap_bytes > 0 ? 100.0 * stats[i].resident_bytes /
+               stats[i].heap_bytes : 0.0, stats[i].util * 100,
+               stats[i].rss_util * 100, stats[i].maxrss_kb,
+               stats[i].filename);
+        util += stats[i].util;
+        rss_util += stats[i].rss_util;
+        nvalid++;
+    }
+    if (nvalid > 0)
+        printf("  %8s %9s %9s %5s %5.0f%% %7.0f%%\n", "", "", "", "",
+               util / nvalid * 100, rss_util / nvalid * 100);
+}
+
+/*
+ * config_item - The i-th build or config parameter reported with the
+ *     machine-readable results, as a key and a string value. Returns
+ *     0 past the last one.
+ */
+static int config_item(int i, const char **key, char *val)
+{
+    switch (i) {
+    case 0:
+        *key = "compiler";
+        strcpy(val, __VERSION__);
+        break;
+    case 1:
+        *key = "cflags";
+        strcpy(val, MDRIVER_CFLAGS);
+        break;
+    case 2:
+        *key = "mm";
+        strcpy(val, mm_funcs->name);
+        break;
+    case 3:
+        *key = "timer";
+        strcpy(val, fsecs_timer());
+        break;
+    case 4:
+        *key = "max_heap";
+        sprintf(val, "%zu", mem_reserve());
+        break;
+    case 5:
+        *key = "alignment";
+        sprintf(val, "%d", ALIGNMENT);
+        break;
+    case 6:
+        *key = "debug_mode";
+        sprintf(val, "%d", debug_mode);
+        break;
+    case 7:
+        *key = "tracedir";
+        strcpy(val, tracedir);
+        break;
+    case 8: {
+        long l1d, l2, llc, line;
+        fcyc_cache_sizes(&l1d, &l2, &llc, &line);
+        *key = "caches";
+        sprintf(val, "L1d %ldK, L2 %ldK, LLC %ldK, line %ld",
+                l1d >> 10, l2 >> 10, llc >> 10, line);
+        break;
+    }
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+/* json_string - Write s as a JSON string */
+static void json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%04x", *s);
+        else
+            fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/* csv_string - Write s as a quoted CSV field */
+static void csv_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', fp);
+        fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * open_timeline - Create the --timeline CSV file and write its header.
+ *     The file is opened for appending and line buffered, so the -j
+ *     workers can share it: each row reaches the file in one write.
+ */
+static FILE *open_timeline(const char *filename)
+{
+    FILE *fp;
+    const char *key;
+    char val[MAXLINE];
+    int i, fd;
+
+    if (!strcmp(filename, "-")) {
+        fp = stdout;
+    } else {
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (fd < 0 || (fp = fdopen(fd, "a")) == NULL)
+            unix_error("Could not open %s in open_timeline", filename);
+        setvbuf(fp, NULL, _IOLBF, 0);
+    }
+
+    for (i = 0; config_item(i, &key, val); i++)
+        fprintf(fp, "# %s=%s\n", key, val);
+    fprintf(fp, "# free_c<i> is the free bytes in blocks of 2^i to "
+            "2^(i+1)-1 bytes\n");
+    fprintf(fp, "trace,op,live_bytes,heap_bytes,free_bytes,largest_free");
+    for (i = 0; i < MM_FP_CLASSES; i++)
+        fprintf(fp, ",free_c%d", i);
+    fprintf(fp, "\n");
+    return fp;
+}
+
+/*
+ * write_results - Write the per-trace stats, the build and config
+ *     parameters and the summary to filename ("-" is stdout), as JSON
+ *     or as CSV. In the CSV, the parameters and the summary are "#"
+ *     comment lines ahead of the header row.
+ */
+static void write_results(const char *filename, int csv, int n,
+                          const stats_t *stats, const summary_t *sum)
+{
+    FILE *fp;
+    const char *key;
+    char val[MAXLINE];
+    double kops, cold_kops;
+    int i;
+
+    if (!strcmp(filename, "-"))
+        fp = stdout;
+    else if ((fp = fopen(filename, "w")) == NULL)
+        unix_error("Could not open %s in write_results", filename);
+
+    if (csv) {
+        for (i = 0; config_item(i, &key, val); i++)
+            fprintf(fp, "# %s=%s\n", key, val);
+        fprintf(fp, "# correct=%d util=%f kops=%f perfindex=%f\n",
+                sum->numcorrect, sum->util, sum->throughput / 1e3,
+                sum->perfindex);
+        fprintf(fp, "trace,valid,weight,util,ops,secs,kops,cold_kops,"
+                "minflt,resident_bytes,rss_util\n");
+    } else {
+        fprintf(fp, "{\n  \"config\": {");
+        for (i = 0; config_item(i, &key, val); i++) {
+            fprintf(fp, "%s\n    ", i ? "," : "");
+            json_string(fp, key);
+            fprintf(fp, ": ");
+            json_string(fp, val);
+        }
+        fprintf(fp, "\n  },\n  \"traces\": [");
+    }
+
+    for (i = 0; i < n; i++) {
+        /* secs and util are only defined for valid traces */
+        kops = (stats[i].valid && stats[i].secs > 0) ?
+            (stats[i].ops / 1e3) / stats[i].secs : 0;
+        cold_kops = (stats[i].valid && stats[i].cold_secs > 0) ?
+            (stats[i].ops / 1e3) / stats[i].cold_secs : 0;
+        if (csv) {
+            csv_string(fp, stats[i].filename);
+            fprintf(fp, ",%d,%d,%f,%.0f,%f,%f,%f,%ld,%zu,%f\n", stats[i].valid,
+                    stats[i].weight, stats[i].valid ? stats[i].util : 0,
+                    stats[i].ops, stats[i].valid ? stats[i].secs : 0, kops,
+                    cold_kops, stats[i].minflt, stats[i].resident_bytes,
+                    stats[i].valid ? stats[i].rss_util : 0);
+        } else {
+            fprintf(fp, "%s\n    { \"trace\": ", i ? "," : "");
+            json_string(fp, stats[i].filename);
+            fprintf(fp, ", \"valid\": %s, \"weight\": %d, \"util\": %f, "
+                    "\"ops\": %.0f, \"secs\": %f, \"kops\": %f",
+                    stats[i].valid ? "true" : "false", stats[i].weight,
+                    stats[i].valid ? stats[i].util : 0, stats[i].ops,
+                    stats[i].valid ? stats[i].secs : 0, kops);
+            if (cold_flag)
+                fprintf(fp, ", \"cold_kops\": %f", cold_kops);
+            if (rss_flag)
+                fprintf(fp, ", \"minflt\": %ld, \"resident_bytes\": %zu, "
+                        "\"rss_util\": %f", stats[i].minflt,
+                        stats[i].resident_bytes,
+                        stats[i].valid ? stats[i].rss_util : 0);
+            fprintf(fp, " }");
+        }
+    }
+
+    if (!csv) {
+        fprintf(fp, "\n  ],\n  \"summary\": { \"correct\": %d, \"util\": %f, "
+                "\"kops\": %f, \"perfindex\": %f, \"errors\": %d }\n}\n",
+                sum->numcorrect, sum->util, sum->throughput / 1e3,
+                sum->perfindex, errors);
+    }
+
+    if (fp != stdout)
+        fclose(fp);
+}
+
+/*
+ * csv_field - Copy the next field of a CSV line at *line into buf and
+ *     move *line past it. Returns 0 at the end of the line.
+ */
+static int csv_field(char **line, char *buf)
+{
+    char *p = *line;
+
+    if (*p == '\0' || *p == '\n')
+        return 0;
+    if (*p == '"') {
+        for (p++; *p && !(*p == '"' && p[1] != '"'); p++) {
+            if (*p == '"')
+                p++;
+            *buf++ = *p;
+        }
+        if (*p == '"')
+            p++;
+    } else {
+        while (*p && *p != ',' && *p != '\n')
+            *buf++ = *p++;
+    }
+    *buf = '\0';
+    if (*p == ',')
+        p++;
+    *line = p;
+    return 1;
+}
+
+/*
+ * compare_baseline - Compare the stats of this run with the CSV results
+ *     of an earlier one (written by --csv), trace by trace, and print
+ *     the changes in util and throughput. A trace regresses if it ran
+ *     correctly in the baseline but not now, or if its util or its
+ *     throughput dropped by more than threshold percent. Returns the
+ *     number of traces that regressed.
+ */
+static int compare_baseline(const char *filename, double threshold,
+                            int n, const stats_t *stats)
+{
+    FILE *fp;
+    char line[4 * MAXLINE], field[MAXLINE], trace[MAXLINE];
+    char *p;
+    int i, base_valid, regressions = 0;
+    double base_util, base_kops, kops, dutil, dkops;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        unix_error("Could not open %s in compare_baseline", filename);
+
+    printf("\nBaseline comparison with %s (threshold %.1f%%):\n",
+           filename, threshold);
+    printf("  %6s %6s %7s %9s %9s %7s  %s\n", "util", "base", "delta",
+           "Kops", "base", "delta", "trace");
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || !strncmp(line, "trace,", 6))
+            continue;
+
+        /* trace,valid,weight,util,ops,secs,kops[,...] */
+        p = line;
+        if (!csv_field(&p, trace) || !csv_field(&p, field))
+            app_error("%s: bad line: %s", filename, line);
+        base_valid = atoi(field);
+        csv_field(&p, field);           /* weight */
+        csv_field(&p, field);
+        base_util = atof(field);
+        csv_field(&p, field);           /* ops */
+        csv_field(&p, field);           /* secs */
+        if (!csv_field(&p, field))
+            app_error("%s: bad line: %s", filename, line);
+        base_kops = atof(field);
+
+        for (i = 0; i < n; i++)
+            if (!strcmp(stats[i].filename, trace))
+                break;
+        if (i == n)
+            continue;   /* not run this time */
+
+        if (!stats[i].valid) {
+            printf("  %6s %6s %7s %9s %9s %7s  %s%s\n", "-", "-", "-", "-",
+                   "-", "-", trace, base_valid ? "  REGRESSED" : "");
+            regressions += base_valid;
+            continue;
+        }
+
+        kops = (stats[i].secs > 0) ? (stats[i].ops / 1e3) / stats[i].secs : 0;
+        dutil = base_util > 0 ? (stats[i].util / base_util - 1) * 100 : 0;
+        dkops = base_kops > 0 ? (kops / base_kops - 1) * 100 : 0;
+        printf("  %5.1f%% %5.1f%% %+6.1f%% %9.0f %9.0f %+6.1f%%  %s",
+               stats[i].util * 100, base_util * 100, dutil, kops, base_kops,
+               dkops, trace);
+        if (base_valid && (dutil < -threshold || dkops < -threshold)) {
+            printf("  REGRESSED");
+            regressions++;
+        }
+        printf("\n");
+    }
+    fclose(fp);
+    return regressions;
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1375,16 +3220,50 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    int i;
+
+    fprintf(stderr, "Usage: mdriver [-hlVCdDLMP] [-f <file>] [-T <n>] [-j <n>] [-b <list>]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <list>  Compare the backends in <list>, comma separated, or all:\n");
+    for (i = 0; i < num_backends; i++)
+        fprintf(stderr, "\t             %-9s %s\n", backends[i].name, backends[i].desc);
+    fprintf(stderr, "\t-C         Report hardware event counts (cache, TLB, branch misses).\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
     fprintf(stderr, "\t-c <file>  Run trace file <file> once, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-j <n>     Run the traces in <n> worker processes, one per CPU.\n");
+    fprintf(stderr, "\t-L         Report per-request latency percentiles.\n");
+    fprintf(stderr, "\t-P         Compare every fit policy build of mm.c.\n");
+    fprintf(stderr, "\t-T <n>     Replay each trace on <n> threads at once (thread-safe mm).\n");
+    fprintf(stderr, "\t-M         With -T, give the threads different traces.\n");
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t--json <file>       Write the results as JSON (- for stdout).\n");
+    fprintf(stderr, "\t--csv <file>        Write the results as CSV (- for stdout).\n");
+    fprintf(stderr, "\t--baseline <file>   Compare with the --csv results of an earlier run,\n");
+    fprintf(stderr, "\t                    and fail if a trace regressed.\n");
+    fprintf(stderr, "\t--threshold <pct>   Regression allowed by --baseline (default 5).\n");
+    fprintf(stderr, "\t--timer <t>         Time with tsc (cycle counter), clock\n");
+    fprintf(stderr, "\t                    (CLOCK_MONOTONIC_RAW), itimer or gettod.\n");
+    fprintf(stderr, "\t--profile           Report the calls and cycles of each phase of mm.c.\n");
+    fprintf(stderr, "\t--sim <spec>        Simulate the caches and TLB under mm.c; <spec> is\n");
+    fprintf(stderr, "\t                    default or like %s.\n", CS_DEFAULT_SPEC);
+    fprintf(stderr, "\t--rss               Report page faults, resident heap pages and\n");
+    fprintf(stderr, "\t                    peak RSS, and the utilization of the resident pages.\n");
+    fprintf(stderr, "\t--reserve <size>    Reserve <size> bytes (K, M or G suffix) for the\n");
+    fprintf(stderr, "\t                    heap of each trace (default %dM).\n", MAX_HEAP >> 20);
+    fprintf(stderr, "\t--check-ctx         Check that the heap contexts of memlib are\n");
+    fprintf(stderr, "\t                    independent, then exit.\n");
+    fprintf(stderr, "\t--cold              Also time each trace with the caches flushed.\n");
+    fprintf(stderr, "\t                    Throughput is otherwise timed with warm caches.\n");
+    fprintf(stderr, "\t--samples <n>       Time by the median of <n> samples, with a confidence\n");
+    fprintf(stderr, "\t                    interval, instead of the K-best.\n");
+    fprintf(stderr, "\t--warmups <n>       Untimed runs before the --samples (default 2).\n");
+    fprintf(stderr, "\t--timeline <file>   Write the heap footprint over time as CSV.\n");
+    fprintf(stderr, "\t--interval <n>      Requests between --timeline samples (default 1000).\n");
 }
@@ -2,6 +2,12 @@
  * memlib.c - a module that simulates the memory system.	Needed because it 
  *						allows us to interleave calls from the student's malloc package 
  *						with the system's malloc package in libc.
+ *
+ * Each heap is a context: a reserved range of address space and a
+ * break within it. The mem_* functions work on the current context of
+ * the calling thread, which is the default heap set up by mem_init
+ * unless mem_set_ctx chose another, so one process can hold many
+ * heaps (arenas, tenants, traces evaluated side by side).
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,79 +22,231 @@
 #include "memlib.h"
 #include "config.h"
 
+struct mem_ctx {
+	char *heap;				/* first byte of the reserved range */
+	char *mem_brk;			/* the break */
+	char *mem_max_addr;		/* end of the reserved range */
+};
+
 /* private variables */
-static char *heap;
-static char *mem_brk;
-static char *mem_max_addr;
+static mem_ctx_t default_ctx;
+static size_t default_reserve = MAX_HEAP;
+static __thread mem_ctx_t *cur_ctx;
+static void (*access_hook)(const void *p, size_t len, int payload);
 
-/* 
- * mem_init - initialize the memory system model
+#define CUR (cur_ctx ? cur_ctx : &default_ctx)
+
+/*
+ * ctx_map - reserve bytes of address space for a heap, at hint if
+ *		possible. Returns 0 on success.
  */
-void mem_init(void){
+static int ctx_map(mem_ctx_t *ctx, void *hint, size_t bytes){
 	int dev_zero = open("/dev/zero", O_RDWR);
-	heap = mmap((void *)0x800000000, /* suggested start*/
-			MAX_HEAP,				/* length */
-			PROT_WRITE,				/* permissions */
-			MAP_PRIVATE,			/* private or shared? */
+	void *p;
+
+	p = mmap(hint,					/* suggested start*/
+			bytes,					/* length */
+			PROT_READ | PROT_WRITE,	/* permissions */
+			MAP_PRIVATE | MAP_NORESERVE,	/* private or shared? */
 			dev_zero,				/* fd */
 			0);						/* offset (dunno) */
-	mem_max_addr = heap + MAX_HEAP;
-	mem_brk = heap;					/* heap is empty initially */
+	if (dev_zero >= 0)
+		close(dev_zero);
+	if (p == MAP_FAILED)
+		return -1;
+	ctx->heap = p;
+	ctx->mem_max_addr = ctx->heap + bytes;
+	ctx->mem_brk = ctx->heap;		/* heap is empty initially */
+	return 0;
+}
+
+/*
+ * mem_set_reserve - set the bytes reserved for the heap of the next
+ *		mem_init (MAX_HEAP by default)
+ */
+void mem_set_reserve(size_t bytes){
+	default_reserve = bytes;
+}
+
+/*
+ * mem_reserve - return the bytes reserved for the current heap
+ */
+size_t mem_reserve(void){
+	return cur_ctx ? mem_ctx_reserve(cur_ctx) : default_reserve;
+}
+
+/* 
+ * mem_init - initialize the memory system model
+ */
+void mem_init(void){
+	if (ctx_map(&default_ctx, (void *)0x800000000, default_reserve) < 0) {
+		fprintf(stderr, "ERROR: mem_init failed to reserve %zu bytes\n",
+				default_reserve);
+		exit(1);
+	}
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-	munmap(heap, MAX_HEAP);
+	munmap(default_ctx.heap, default_ctx.mem_max_addr - default_ctx.heap);
+	memset(&default_ctx, 0, sizeof(default_ctx));
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_ctx_create - reserve a new heap of the given bytes (MAX_HEAP if
+ *		0). Returns NULL if the address space cannot be had.
  */
-void mem_reset_brk(){
-	mem_brk = heap;
+mem_ctx_t *mem_ctx_create(size_t reserve){
+	mem_ctx_t *ctx = malloc(sizeof(mem_ctx_t));
+
+	if (ctx == NULL)
+		return NULL;
+	if (ctx_map(ctx, NULL, reserve ? reserve : MAX_HEAP) < 0) {
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+/*
+ * mem_ctx_destroy - release a heap made by mem_ctx_create
+ */
+void mem_ctx_destroy(mem_ctx_t *ctx){
+	if (cur_ctx == ctx)
+		cur_ctx = NULL;
+	munmap(ctx->heap, ctx->mem_max_addr - ctx->heap);
+	free(ctx);
+}
+
+/*
+ * mem_set_ctx - make ctx the current heap of the calling thread, or
+ *		the default heap if ctx is NULL. Returns the previous one.
+ */
+mem_ctx_t *mem_set_ctx(mem_ctx_t *ctx){
+	mem_ctx_t *old = cur_ctx;
+
+	cur_ctx = ctx;
+	return old;
+}
+
+/*
+ * mem_ctx_reset_brk - reset the simulated brk pointer to make an empty heap
+ */
+void mem_ctx_reset_brk(mem_ctx_t *ctx){
+	ctx->mem_brk = ctx->heap;
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
+ * mem_ctx_sbrk - simple model of the sbrk function. Extends the heap 
  *		by incr bytes and returns the start address of the new area. In
  *		this model, the heap cannot be shrunk.
  */
-void *mem_sbrk(int incr) {
-	char *old_brk = mem_brk;
+void *mem_ctx_sbrk(mem_ctx_t *ctx, int incr) {
+	char *old_brk = ctx->mem_brk;
 
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+    // Only the default heap does, as the process has just the one break.
+	if ( (incr < 0) || (incr > ctx->mem_max_addr - ctx->mem_brk) ||
+            (ctx == &default_ctx && sbrk(incr) == (void *) -1)) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
 
-	mem_brk += incr;
+	ctx->mem_brk += incr;
 	return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_ctx_heap_lo - return address of the first heap byte
  */
-void *mem_heap_lo(){
-	return (void *)heap;
+void *mem_ctx_heap_lo(mem_ctx_t *ctx){
+	return (void *)ctx->heap;
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_ctx_heap_hi - return address of last heap byte
  */
-void *mem_heap_hi(){
-	return (void *)(mem_brk - 1);
+void *mem_ctx_heap_hi(mem_ctx_t *ctx){
+	return (void *)(ctx->mem_brk - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_ctx_heapsize() - returns the heap size in bytes
  */
+size_t mem_ctx_heapsize(mem_ctx_t *ctx) {
+	return (size_t)(ctx->mem_brk - ctx->heap);
+}
+
+/*
+ * mem_ctx_reserve() - returns the bytes reserved for the heap
+ */
+size_t mem_ctx_reserve(mem_ctx_t *ctx) {
+	return (size_t)(ctx->mem_max_addr - ctx->heap);
+}
+
+/*
+ * mem_ctx_resident() - returns the bytes of the heap resident in memory,
+ *		a whole page at a time; pages above the brk are not counted
+ */
+size_t mem_ctx_resident(mem_ctx_t *ctx){
+	size_t page = mem_pagesize();
+	size_t npages = (mem_ctx_heapsize(ctx) + page - 1) / page;
+	size_t i, resident = 0;
+	unsigned char *vec;
+
+	if (npages == 0)
+		return 0;
+	if ((vec = malloc(npages)) == NULL)
+		return 0;
+	if (mincore(ctx->heap, npages * page, vec) == 0) {
+		for (i = 0; i < npages; i++)
+			resident += vec[i] & 1;
+	}
+	free(vec);
+	return resident * page;
+}
+
+/*
+ * mem_ctx_drop_pages() - give the pages of the heap back to the kernel,
+ *		so that only the pages touched from now on are resident. The
+ *		heap reads as zeros afterwards.
+ */
+void mem_ctx_drop_pages(mem_ctx_t *ctx){
+	madvise(ctx->heap, ctx->mem_max_addr - ctx->heap, MADV_DONTNEED);
+}
+
+/*
+ * The same, on the current heap
+ */
+void mem_reset_brk(){
+	mem_ctx_reset_brk(CUR);
+}
+
+void *mem_sbrk(int incr) {
+	return mem_ctx_sbrk(CUR, incr);
+}
+
+void *mem_heap_lo(){
+	return mem_ctx_heap_lo(CUR);
+}
+
+void *mem_heap_hi(){
+	return mem_ctx_heap_hi(CUR);
+}
+
 size_t mem_heapsize() {
-	return (size_t)((void *)mem_brk - (void *)heap);
+	return mem_ctx_heapsize(CUR);
+}
+
+size_t mem_resident(){
+	return mem_ctx_resident(CUR);
+}
+
+void mem_drop_pages(){
+	mem_ctx_drop_pages(CUR);
 }
 
 /*
@@ -97,3 +255,20 @@ size_t mem_heapsize() {
 size_t mem_pagesize(){
 	return (size_t)getpagesize();
 }
+
+/*
+ * mem_set_access_hook - call hook on every mem_access, or stop
+ *		if hook is NULL
+ */
+void mem_set_access_hook(void (*hook)(const void *p, size_t len, int payload)){
+	access_hook = hook;
+}
+
+/*
+ * mem_access - report an access of len bytes at p to the hook. Builds
+ *		of mm.c with -DMM_SIMULATE call this on every word they touch.
+ */
+void mem_access(const void *p, size_t len, int payload){
+	if (access_hook)
+		access_hook(p, len, payload);
+}
@@ -8,4 +8,32 @@ void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_resident(void);
+void mem_drop_pages(void);
 
+/* The bytes reserved for the heap of the next mem_init (default
+   MAX_HEAP in config.h), and for the current heap */
+void mem_set_reserve(size_t bytes);
+size_t mem_reserve(void);
+
+/* Heap contexts: independent heaps, each with its own reserved range
+   and break. The functions above work on the calling thread's current
+   heap, the one set up by mem_init unless mem_set_ctx says otherwise. */
+typedef struct mem_ctx mem_ctx_t;
+
+mem_ctx_t *mem_ctx_create(size_t reserve);
+void mem_ctx_destroy(mem_ctx_t *ctx);
+mem_ctx_t *mem_set_ctx(mem_ctx_t *ctx);
+void *mem_ctx_sbrk(mem_ctx_t *ctx, int incr);
+void mem_ctx_reset_brk(mem_ctx_t *ctx);
+void *mem_ctx_heap_lo(mem_ctx_t *ctx);
+void *mem_ctx_heap_hi(mem_ctx_t *ctx);
+size_t mem_ctx_heapsize(mem_ctx_t *ctx);
+size_t mem_ctx_reserve(mem_ctx_t *ctx);
+size_t mem_ctx_resident(mem_ctx_t *ctx);
+void mem_ctx_drop_pages(mem_ctx_t *ctx);
+
+/* Accesses to the heap, reported to a hook such as the locality
+   simulator (mdriver --sim); payload is 0 for allocator metadata */
+void mem_set_access_hook(void (*hook)(const void *p, size_t len, int payload));
+void mem_access(const void *p, size_t len, int payload);
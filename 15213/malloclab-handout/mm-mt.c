@@ -0,0 +1,88 @@
+/*
+ * mm-mt.c - Thread-safe build of the mm package
+ *
+ * mm.c keeps its free lists in globals and is not thread safe. This
+ * file wraps a copy of it, built with -DMM_PREFIX=mtu_ (see the
+ * Makefile), so that every entry point runs under one global mutex.
+ * The mutex also covers mem_sbrk, which is only called from inside
+ * the mm package.
+ *
+ * The wrapped entry points are exported as mt_mm_malloc etc., for
+ * mdriver's multi-threaded replay (-T).
+ */
+#include <pthread.h>
+#include <stdio.h>
+
+#include "mm.h"
+
+/* The unlocked copy of mm.c */
+extern int mtu_mm_init(void);
+extern void *mtu_mm_malloc(size_t size);
+extern void mtu_mm_free(void *ptr);
+extern void *mtu_mm_realloc(void *ptr, size_t size);
+extern void *mtu_mm_calloc(size_t nmemb, size_t size);
+extern void mtu_mm_checkheap(int verbose);
+extern void mtu_mm_footprint(mm_footprint_t *fp);
+
+static pthread_mutex_t mt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int mt_mm_init(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&mt_lock);
+    ret = mtu_mm_init();
+    pthread_mutex_unlock(&mt_lock);
+    return ret;
+}
+
+void *mt_mm_malloc(size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mt_lock);
+    p = mtu_mm_malloc(size);
+    pthread_mutex_unlock(&mt_lock);
+    return p;
+}
+
+void mt_mm_free(void *ptr)
+{
+    pthread_mutex_lock(&mt_lock);
+    mtu_mm_free(ptr);
+    pthread_mutex_unlock(&mt_lock);
+}
+
+void *mt_mm_realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mt_lock);
+    p = mtu_mm_realloc(ptr, size);
+    pthread_mutex_unlock(&mt_lock);
+    return p;
+}
+
+void *mt_mm_calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    pthread_mutex_lock(&mt_lock);
+    p = mtu_mm_calloc(nmemb, size);
+    pthread_mutex_unlock(&mt_lock);
+    return p;
+}
+
+void mt_mm_checkheap(int verbose)
+{
+    pthread_mutex_lock(&mt_lock);
+    mtu_mm_checkheap(verbose);
+    pthread_mutex_unlock(&mt_lock);
+}
+
+void mt_mm_footprint(mm_footprint_t *fp)
+{
+    pthread_mutex_lock(&mt_lock);
+    mtu_mm_footprint(fp);
+    pthread_mutex_unlock(&mt_lock);
+}
@@ -15,6 +15,23 @@
 #include <string.h>
 #include <unistd.h>
 
+/*
+ * Compiling with -DMM_PREFIX=<p> renames the public entry points to
+ * <p>mm_malloc etc., so this file can be linked into mdriver next to
+ * mm.c (mdriver -b).
+ */
+#ifdef MM_PREFIX
+#define MM_CAT2(a,b) a##b
+#define MM_CAT(a,b) MM_CAT2(a,b)
+#define mm_init      MM_CAT(MM_PREFIX,mm_init)
+#define mm_malloc    MM_CAT(MM_PREFIX,mm_malloc)
+#define mm_free      MM_CAT(MM_PREFIX,mm_free)
+#define mm_realloc   MM_CAT(MM_PREFIX,mm_realloc)
+#define mm_calloc    MM_CAT(MM_PREFIX,mm_calloc)
+#define mm_checkheap MM_CAT(MM_PREFIX,mm_checkheap)
+#define mm_footprint MM_CAT(MM_PREFIX,mm_footprint)
+#endif
+
 #include "mm.h"
 #include "memlib.h"
 
@@ -146,3 +163,10 @@ void mm_checkheap(int verbose){
 	/*Get gcc to be quiet. */
 	verbose = verbose;
 }
+
+/*
+ * mm_footprint - Nothing is ever freed, so there is no free space.
+ */
+void mm_footprint(mm_footprint_t *fp){
+	memset(fp, 0, sizeof(*fp));
+}
@@ -20,11 +20,53 @@
  * Within each segregated class, size of free blocks are in ascending order.
  * Inserting coalesed free block with ascending order as well.
  *
- * Placing a block is First fit/Best fit policy.
+ * Placing a block is First fit/Best fit policy. Other fit policies can
+ * be picked at compile time with -DFIT_POLICY=<policy>:
+ *   FIT_FIRST   -- unordered (LIFO) classes, first adequate block
+ *   FIT_BEST    -- ordered classes, first adequate block (default)
+ *   FIT_BOUNDED -- unordered classes, best of the first FIT_PROBES
+ *                  blocks of each class before moving up a class
+ *   FIT_NEXT    -- unordered classes, first fit resumed from a
+ *                  per-class rover
+ * Only FIT_BEST pays for the ordered insert.
+ *
+ * Skip lists (FIT_BEST only):
+ *   Blocks of at least 2^SKIP_MIN_CLASS bytes are ordered by (size,
+ *   address); smaller ones by size alone, a new block going ahead of
+ *   those of its size. Once a class of the larger blocks holds more than SKIP_THRESHOLD blocks,
+ *   it grows an intrusive skip list on top of the NEXT/PREV list, so
+ *   insert, unlink and find_fit become O(log n) for that class:
+ *
+ *   header:4, NEXT:4, PREV:4, height:4, FWD[1..height-1]:4 each, ..., footer:4
+ *
+ *   FWD pointers are compressed like NEXT and PREV. The class drops
+ *   back to a plain list when it shrinks below SKIP_THRESHOLD/4.
  *
  * Insert immediatly after free.
  * Coalesce immediatly after insert.
  *
+ * Optional side table (compile with -DMETA_BITMAP):
+ *   Block starts and allocation state are mirrored in two bitmaps
+ *   indexed by heap offset, one bit per 8-byte granule. Neighbour
+ *   checks in coalesce and heap walks in mm_checkheap read the dense
+ *   bitmaps instead of the boundary tags next to the payloads. The
+ *   size (and so the class) of a block is the distance to the next
+ *   start bit. Boundary tags are still kept, so the two views can be
+ *   cross-checked. mm_init maps the bitmaps to cover mem_reserve().
+ *
+ * Optional locality simulation (compile with -DMM_SIMULATE):
+ *   Every word read or written through GET and PUT, and the payload
+ *   copies of realloc and calloc, are reported to mem_access, which
+ *   mdriver --sim feeds to its cache and TLB simulator.
+ *
+ * Optional profile (compile with -DMM_PROFILE):
+ *   Every entry point and internal phase (find_fit, place, insert,
+ *   unlink_blk, coalesce, extend_heap) counts its calls and its self
+ *   cycles, i.e. excluding the phases it calls, and find_fit and the
+ *   ordered insert count the free blocks they step over. mm_profile
+ *   reports the counts since mm_init. Without MM_PROFILE the hooks
+ *   compile to nothing.
+ *
  */
 #include <assert.h>
 #include <stdio.h>
@@ -32,6 +74,27 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/*
+ * Compiling with -DMM_PREFIX=<p> renames the public entry points to
+ * <p>mm_malloc etc., so that several builds of this file (e.g. one per
+ * fit policy) can be linked into the same driver.
+ */
+#ifdef MM_PREFIX
+#define MM_CAT2(a,b) a##b
+#define MM_CAT(a,b) MM_CAT2(a,b)
+#define mm_init      MM_CAT(MM_PREFIX,mm_init)
+#define mm_malloc    MM_CAT(MM_PREFIX,mm_malloc)
+#define mm_free      MM_CAT(MM_PREFIX,mm_free)
+#define mm_realloc   MM_CAT(MM_PREFIX,mm_realloc)
+#define mm_calloc    MM_CAT(MM_PREFIX,mm_calloc)
+#define mm_checkheap MM_CAT(MM_PREFIX,mm_checkheap)
+#define mm_footprint MM_CAT(MM_PREFIX,mm_footprint)
+#define mm_profile   MM_CAT(MM_PREFIX,mm_profile)
+#endif
+
 #include "mm.h"
 #include "memlib.h"
 
@@ -78,14 +141,44 @@
 #define class 27
 #define l_size 16
 
+/* Fit policies, see the top of the file */
+#define FIT_FIRST   0
+#define FIT_BEST    1
+#define FIT_BOUNDED 2
+#define FIT_NEXT    3
+
+#ifndef FIT_POLICY
+#define FIT_POLICY FIT_BEST
+#endif
+
+#ifndef FIT_PROBES
+#define FIT_PROBES  8   /* probe budget per class for FIT_BOUNDED */
+#endif
+
+/* Skip lists on long classes, see the top of the file */
+#ifndef SKIP_THRESHOLD
+#define SKIP_THRESHOLD 64   /* list length that turns a class into a skip list */
+#endif
+#define SKIP_MIN_CLASS 6    /* 64 byte blocks have room for all the levels */
+#define SKIP_LEVELS    12
+
+#define SKIP_LISTS (FIT_POLICY == FIT_BEST && SKIP_THRESHOLD > 0)
+
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
 
 /* Read and write a word at address p */
+#ifdef MM_SIMULATE
+#define GET(p)       (mem_access((p), WSIZE, 0), *((unsigned int *)(p)))
+#define PUT(p, val)  (mem_access((p), WSIZE, 0), *(unsigned int *)(p) = (val))
+#define SIM_ACCESS(p, len, payload) mem_access((p), (len), (payload))
+#else
 #define GET(p)       (*((unsigned int *)(p)))
 #define PUT(p, val)  (*(unsigned int *)(p) = (val))
+#define SIM_ACCESS(p, len, payload)
+#endif
 
 //#define PUT_PTR(p1,p2) (p1=p2)
 
@@ -110,31 +203,31 @@
 #define NEXT(bp) (w2p(GET(bp)))
 #define PREV(bp) (w2p(GET(bp+WSIZE)))
 
-#define heap_start 0x800000000   //heap starts at here by observation
-
-char *heap_listp=0;
+static char *heap_listp=0;
+static char *heap_start=0;      /* mem_heap_lo(), set by mm_init */
 
 /* Cast an unsigned int into a pointer*/
 static inline void* w2p(unsigned int w){
     if (w==0) return NULL;
-    return (void *)((unsigned long)(w)+heap_start);
+    return heap_start + w;
 }
 
 /* Cast a pointer into unsigned int*/
 static inline unsigned int p2w(void *p){
     if (p==NULL) return 0;
-    return (unsigned int)((uint64_t)(p));
+    return (unsigned int)((char *)p - heap_start);
 }
 
-/* Return the right most bit*/
+/* Return the right most bit; the last class takes every larger block,
+ * since a heap reserved past 2^class bytes can hold them */
 static inline int find_bound(size_t n){
-    for (int i=0; i<class; i++){
+    for (int i=0; i<class-1; i++){
         n=n>>1;
         if (n==0) {
             return i;
         }
     }
-    return -1;
+    return class-1;
 }
 
 /*
@@ -152,14 +245,353 @@ static int aligned(const void *p) {
     return (size_t)ALIGN(p) == (size_t)p;
 }
 
-void *extend_heap(size_t size);
-void insert(size_t size, void *bp);
-void *find_fit(size_t asize);
-void *place(size_t size,void *bp);
-void coalesce(void *bp);
-void unlink_blk(void *ptr);
+#ifdef MM_PROFILE
+/*
+ * Profile: self cycles are charged to the phase on top of a stack of
+ * the phases entered; PROF_PHASE pushes one for the rest of the
+ * function, popping it on every return.
+ */
+static mm_profile_t prof;
+static int prof_stack[MM_PROF_PHASES * 2];
+static int prof_depth;
+static uint64_t prof_last;
+
+static inline uint64_t prof_now(void){
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
 
-char *seg[class];
+static inline int prof_enter(int phase){
+    uint64_t now = prof_now();
+
+    if (prof_depth > 0)
+        prof.cycles[prof_stack[prof_depth-1]] += now - prof_last;
+    prof_stack[prof_depth++] = phase;
+    prof.calls[phase]++;
+    prof_last = now;
+    return phase;
+}
+
+static inline void prof_exit(int *phase){
+    uint64_t now = prof_now();
+
+    prof.cycles[*phase] += now - prof_last;
+    prof_depth--;
+    prof_last = now;
+}
+
+#define PROF_PHASE(phase) \
+    int prof_phase __attribute__((cleanup(prof_exit), unused)) = prof_enter(phase)
+#define PROF_COUNT(field)  (prof.field++)
+#else
+#define PROF_PHASE(phase)
+#define PROF_COUNT(field)
+#endif
+
+static void *extend_heap(size_t size);
+static void insert(size_t size, void *bp);
+static void *find_fit(size_t asize);
+static void *place(size_t size,void *bp);
+static void coalesce(void *bp);
+static void unlink_blk(void *ptr);
+
+static char *seg[class];
+
+#if FIT_POLICY == FIT_NEXT
+static char *rover[class];    /* where the last search of a class stopped */
+#endif
+
+#if FIT_POLICY == FIT_BEST
+/* Order blocks by size, then address */
+static inline int key_less(void *x, size_t size, void *bp){
+    size_t xsize = GET_SIZE(HDRP(x));
+    return xsize < size || (xsize == size && (char *)x < (char *)bp);
+}
+
+/* Does x go before bp (of the given size) in class i? Only classes
+ * that can become skip lists need the address to break ties; in the
+ * others a block goes in ahead of the blocks of its own size, so the
+ * many blocks of a common small size cost nothing to walk past. */
+static inline int class_less(int i, void *x, size_t size, void *bp){
+#if SKIP_LISTS
+    if (i >= SKIP_MIN_CLASS)
+        return key_less(x, size, bp);
+#else
+    (void)i;
+    (void)bp;
+#endif
+    return GET_SIZE(HDRP(x)) < size;
+}
+#endif
+
+#if SKIP_LISTS
+static int seg_len[class];                   /* blocks in each class */
+static int skip_on[class];                   /* class uses its skip list */
+static int skip_top[class];                  /* tallest block since skip_build */
+static char *skip_head[class][SKIP_LEVELS];  /* level 0 is seg[] itself */
+static unsigned int skip_seed;
+
+/* Given block ptr bp in a skip class, its height and FWD pointers */
+#define SKIP_HEIGHTP(bp)    ((char *)(bp) + DSIZE)
+#define SKIP_HEIGHT(bp)     GET(SKIP_HEIGHTP(bp))
+#define SKIP_FWDP(bp, l)    ((char *)(bp) + ((l) + 2) * WSIZE)
+
+/* Successor of x at level l, x==NULL standing for the class head */
+static inline void *skip_next(int i, void *x, int l){
+    if (x == NULL)
+        return (l == 0) ? seg[i] : skip_head[i][l];
+    return (l == 0) ? NEXT(x) : w2p(GET(SKIP_FWDP(x, l)));
+}
+
+static inline void skip_set_next(int i, void *x, int l, void *val){
+    if (x == NULL){
+        if (l == 0)
+            seg[i] = val;
+        else
+            skip_head[i][l] = val;
+    }
+    else if (l == 0){
+        MAKE_NEXT(x, val);
+    }
+    else{
+        PUT(SKIP_FWDP(x, l), p2w(val));
+    }
+}
+
+/* Random height with p=1/4 per level, capped by what fits in the block */
+static int skip_height(size_t size){
+    int max = (size - 5 * WSIZE) / WSIZE + 1;
+    int h = 1;
+    unsigned int r;
+
+    skip_seed ^= skip_seed << 13;
+    skip_seed ^= skip_seed >> 17;
+    skip_seed ^= skip_seed << 5;
+    r = skip_seed;
+
+    if (max > SKIP_LEVELS)
+        max = SKIP_LEVELS;
+    while (h < max && (r & 3) == 0){
+        h++;
+        r >>= 2;
+    }
+    return h;
+}
+
+/* Turn the ordered list of class i into a skip list in one pass */
+static void skip_build(int i){
+    void *last[SKIP_LEVELS];
+    void *bp;
+    int l, h;
+
+    for (l = 1; l < SKIP_LEVELS; l++)
+        last[l] = NULL;
+
+    skip_top[i] = 1;
+    for (bp = seg[i]; bp != NULL; bp = NEXT(bp)){
+        h = skip_height(GET_SIZE(HDRP(bp)));
+        PUT(SKIP_HEIGHTP(bp), h);
+        if (h > skip_top[i])
+            skip_top[i] = h;
+        for (l = 1; l < h; l++){
+            skip_set_next(i, last[l], l, bp);
+            last[l] = bp;
+        }
+    }
+    for (l = 1; l < SKIP_LEVELS; l++)
+        skip_set_next(i, last[l], l, NULL);
+
+    skip_on[i] = 1;
+}
+
+/* Insert bp (of the given size) into the skip list of class i */
+static void skip_insert(int i, size_t size, void *bp){
+    void *update[SKIP_LEVELS];
+    void *x = NULL;
+    void *next;
+    int l, h;
+
+    h = skip_height(size);
+    if (h > skip_top[i]){
+        for (l = skip_top[i]; l < h; l++)
+            skip_head[i][l] = NULL;
+        skip_top[i] = h;
+    }
+
+    for (l = skip_top[i] - 1; l >= 0; l--){
+        while ((next = skip_next(i, x, l)) != NULL && key_less(next, size, bp)){
+            PROF_COUNT(insert_probes);
+            x = next;
+        }
+        update[l] = x;
+    }
+
+    PUT(SKIP_HEIGHTP(bp), h);
+    for (l = 1; l < h; l++){
+        PUT(SKIP_FWDP(bp, l), p2w(skip_next(i, update[l], l)));
+        skip_set_next(i, update[l], l, bp);
+    }
+
+    next = skip_next(i, update[0], 0);
+    MAKE_NEXT(bp, next);
+    MAKE_PREV(bp, update[0]);
+    if (next != NULL)
+        MAKE_PREV(next, bp);
+    skip_set_next(i, update[0], 0, bp);
+}
+
+/* Remove bp from the upper levels of class i; level 0 is left to
+ * unlink_blk, which has PREV */
+static void skip_unlink(int i, void *bp){
+    size_t size = GET_SIZE(HDRP(bp));
+    int h = SKIP_HEIGHT(bp);
+    void *x = NULL;
+    void *next;
+    int l;
+
+    for (l = skip_top[i] - 1; l >= 1; l--){
+        while ((next = skip_next(i, x, l)) != NULL && key_less(next, size, bp))
+            x = next;
+        if (l < h && next == bp)
+            skip_set_next(i, x, l, w2p(GET(SKIP_FWDP(bp, l))));
+    }
+}
+
+/* First block of class i with at least asize bytes */
+static void *skip_find(int i, size_t asize){
+    void *x = NULL;
+    void *next;
+    int l;
+
+    for (l = skip_top[i] - 1; l >= 0; l--){
+        while ((next = skip_next(i, x, l)) != NULL &&
+               GET_SIZE(HDRP(next)) < asize){
+            PROF_COUNT(fit_probes);
+            x = next;
+        }
+    }
+    return skip_next(i, x, 0);
+}
+#endif
+
+#ifdef META_BITMAP
+/*
+ * Side table: granule g covers heap bytes [8g, 8g+8). A block whose
+ * payload starts at granule g and has size s owns granules [g, g+s/8).
+ *
+ *   meta_start: bit set at the first granule of every block
+ *   meta_alloc: bit set at every granule of an allocated block, so the
+ *               state of the block just before bp is at granule g-1
+ */
+static uint64_t *meta_start = NULL;
+static uint64_t *meta_alloc = NULL;
+static size_t meta_words = 0;       /* words of each bitmap, for the reserve */
+static size_t meta_used = 0;        /* words dirtied since last mm_init */
+
+#define GRAN(bp) ((size_t)((char *)(bp) - (char *)mem_heap_lo()) / DSIZE)
+#define GRAN2P(g) ((void *)((char *)mem_heap_lo() + (g) * DSIZE))
+
+static inline int meta_test(const uint64_t *map, size_t g){
+    return (map[g >> 6] >> (g & 63)) & 1;
+}
+
+static inline void meta_set(uint64_t *map, size_t g){
+    map[g >> 6] |= 1UL << (g & 63);
+}
+
+static inline void meta_clr(uint64_t *map, size_t g){
+    map[g >> 6] &= ~(1UL << (g & 63));
+}
+
+/* Set or clear granules [lo, lo+n) of map a word at a time */
+static void meta_fill(uint64_t *map, size_t lo, size_t n, int val){
+    size_t hi = lo + n;
+    size_t w;
+
+    if (n == 0)
+        return;
+    if ((hi >> 6) + 1 > meta_used)
+        meta_used = (hi >> 6) + 1;
+
+    for (w = lo >> 6; w <= (hi - 1) >> 6; w++){
+        uint64_t mask = ~0UL;
+        if (w == lo >> 6)
+            mask &= ~0UL << (lo & 63);
+        if (w == (hi - 1) >> 6 && (hi & 63))
+            mask &= ~0UL >> (64 - (hi & 63));
+        if (val)
+            map[w] |= mask;
+        else
+            map[w] &= ~mask;
+    }
+}
+
+/* Record block bp of the given size and state in the side table */
+static inline void meta_block(void *bp, size_t size, int alloc){
+    size_t g = GRAN(bp);
+    meta_set(meta_start, g);
+    meta_fill(meta_alloc, g, size / DSIZE, alloc);
+}
+
+/* Block bp has been merged into its predecessor */
+static inline void meta_absorb(void *bp){
+    meta_clr(meta_start, GRAN(bp));
+}
+
+/* Return the first block start strictly after granule g */
+static size_t meta_next_start(size_t g){
+    size_t w = (g + 1) >> 6;
+    uint64_t bits = meta_start[w] & (~0UL << ((g + 1) & 63));
+
+    while (bits == 0 && ++w < meta_used)
+        bits = meta_start[w];
+    if (bits == 0)
+        return 0;
+    return (w << 6) + __builtin_ctzl(bits);
+}
+
+/*
+ * Map bitmaps that cover the whole reserve of the heap, or clear the
+ * words dirtied since the last mm_init. Return -1 on error, 0 on success.
+ */
+static int meta_init(void){
+    size_t words = mem_reserve() / DSIZE / 64 + 1;
+
+    if (words != meta_words){
+        if (meta_words){
+            munmap(meta_start, 2 * meta_words * sizeof(uint64_t));
+            meta_words = 0;
+        }
+        meta_start = mmap(NULL, 2 * words * sizeof(uint64_t),
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (meta_start == MAP_FAILED)
+            return -1;
+        meta_alloc = meta_start + words;
+        meta_words = words;
+    } else {
+        memset(meta_start, 0, meta_used * sizeof(uint64_t));
+        memset(meta_alloc, 0, meta_used * sizeof(uint64_t));
+    }
+    meta_used = 0;
+    return 0;
+}
+#define META_BLOCK(bp, size, alloc) meta_block(bp, size, alloc)
+#define META_ABSORB(bp)             meta_absorb(bp)
+#else
+#define META_BLOCK(bp, size, alloc)
+#define META_ABSORB(bp)
+#endif
+
+/* The heap offsets of NEXT and PREV are 4 bytes */
+#define HEAP_LIMIT                  ((size_t)UINT32_MAX)
 
 
 /*
@@ -169,7 +601,12 @@ char *seg[class];
  */
 int mm_init(void) {
 
+#ifdef MM_PROFILE
+    memset(&prof, 0, sizeof(prof));
+    prof_depth = 0;
+#endif
     heap_listp=0;
+    heap_start=mem_heap_lo();
     /* Create the initial empty heap */
     if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
          return -1;
@@ -180,9 +617,29 @@ int mm_init(void) {
     PUT(heap_listp+(3*WSIZE), PACK(0, 1)); /* Epilogue header */
     heap_listp += DSIZE;
 
+#ifdef META_BITMAP
+    if (meta_init() < 0)
+        return -1;
+    META_BLOCK(heap_listp, DSIZE, 1);               /* Prologue */
+    META_BLOCK(heap_listp + DSIZE, DSIZE, 1);       /* Epilogue */
+#endif
+
     for (int i=0; i<class; i++){
         seg[i]=NULL;
+#if FIT_POLICY == FIT_NEXT
+        rover[i]=NULL;
+#endif
+#if SKIP_LISTS
+        seg_len[i]=0;
+        skip_on[i]=0;
+        for (int l=0; l<SKIP_LEVELS; l++){
+            skip_head[i][l]=NULL;
+        }
+#endif
     }
+#if SKIP_LISTS
+    skip_seed=2463534242u;
+#endif
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
     if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
         return -1;
@@ -199,7 +656,8 @@ int mm_init(void) {
  * Since linked block are in ascending order, this is first fit as well
  * as best fit
  */
-void *find_fit(size_t asize){
+static void *find_fit(size_t asize){
+    PROF_PHASE(MM_PROF_FIND_FIT);
     int bound;
     void *bp;
 
@@ -207,9 +665,60 @@ void *find_fit(size_t asize){
     //assert(bound>=4);
     assert(bound<class);
 
+#if FIT_POLICY == FIT_BOUNDED
+    /* Best of the first FIT_PROBES blocks, then give up on the class.
+     * Every block above the bound class fits, so only the bound class
+     * can be missed this way. */
+    for (int i=bound; i<class; i++){
+        void *best=NULL;
+        int probes=0;
+
+        for (bp=seg[i]; bp!=NULL && probes<FIT_PROBES; bp=NEXT(bp)){
+            size_t bsize=GET_SIZE(HDRP(bp));
+            probes++;
+            PROF_COUNT(fit_probes);
+            if (bsize>=asize &&
+                (best==NULL || bsize<GET_SIZE(HDRP(best)))){
+                best=bp;
+                if (bsize==asize)
+                    break;
+            }
+        }
+        if (best!=NULL)
+            return best;
+    }
+#elif FIT_POLICY == FIT_NEXT
+    /* Resume from the rover, then wrap around to the head of the class */
+    for (int i=bound; i<class; i++){
+        void *start=(rover[i]!=NULL) ? rover[i] : seg[i];
 
+        for (bp=start; bp!=NULL; bp=NEXT(bp)){
+            PROF_COUNT(fit_probes);
+            if (GET_SIZE(HDRP(bp))>=asize){
+                rover[i]=NEXT(bp);
+                return bp;
+            }
+        }
+        for (bp=seg[i]; bp!=start; bp=NEXT(bp)){
+            PROF_COUNT(fit_probes);
+            if (GET_SIZE(HDRP(bp))>=asize){
+                rover[i]=NEXT(bp);
+                return bp;
+            }
+        }
+    }
+#else
     for (int i=bound; i<class; i++){
+#if SKIP_LISTS
+        if (skip_on[i]){
+            if ((bp=skip_find(i,asize))!=NULL){
+                return bp;
+            }
+            continue;
+        }
+#endif
         for (bp=seg[i]; bp!=NULL; bp=NEXT(bp)){
+            PROF_COUNT(fit_probes);
             if ((!GET_ALLOC(HDRP(bp)))&&(GET_SIZE(HDRP(bp))>=asize)){
                 return bp;
 
@@ -217,18 +726,44 @@ void *find_fit(size_t asize){
 
         }
     }
+#endif
 
     return NULL;
 }
 
 /* Insert the given pointer in to its size class
  *  and make sure within the class blocks are ordered
+ *
+ * Policies other than FIT_BEST don't need the order and just push
+ * the block at the head of the class.
  */
-void insert(size_t size, void *bp){
+static void insert(size_t size, void *bp){
+    PROF_PHASE(MM_PROF_INSERT);
     int bound=find_bound(size);
-    void* next;
     void* ptr=seg[bound];
 
+#if FIT_POLICY != FIT_BEST
+    MAKE_NEXT(bp,ptr);
+    MAKE_PREV(bp,NULL);
+    if (ptr!=NULL){
+        MAKE_PREV(ptr,bp);
+    }
+    seg[bound]=bp;
+#else
+    void* next;
+
+#if SKIP_LISTS
+    seg_len[bound]++;
+    if (!skip_on[bound] && bound>=SKIP_MIN_CLASS &&
+        seg_len[bound]>SKIP_THRESHOLD){
+        skip_build(bound);
+    }
+    if (skip_on[bound]){
+        skip_insert(bound,size,bp);
+        return;
+    }
+#endif
+
     if (ptr==NULL){
         seg[bound]=bp;
         MAKE_NEXT(bp,NULL);
@@ -236,7 +771,7 @@ void insert(size_t size, void *bp){
         return;
     }
 
-    if (GET_SIZE(HDRP(ptr))>=size){
+    if (!class_less(bound,ptr,size,bp)){
         MAKE_PREV(ptr,bp);
         MAKE_NEXT(bp,ptr);
         MAKE_PREV(bp,NULL);
@@ -246,6 +781,7 @@ void insert(size_t size, void *bp){
 
     while(ptr!=NULL){
         next=NEXT(ptr);
+        PROF_COUNT(insert_probes);
 
         if (next==NULL){
             MAKE_NEXT(ptr,bp);
@@ -253,7 +789,7 @@ void insert(size_t size, void *bp){
             MAKE_NEXT(bp,NULL);
             return;
         }
-        if (GET_SIZE(HDRP(next))>=size){
+        if (!class_less(bound,next,size,bp)){
             MAKE_NEXT(bp,next);
             MAKE_PREV(bp,ptr);
             MAKE_NEXT(ptr,bp);
@@ -265,6 +801,7 @@ void insert(size_t size, void *bp){
     }
 
     printf("Shouldn't get here\n");
+#endif
     return;
 }
 
@@ -272,7 +809,8 @@ void insert(size_t size, void *bp){
  *  larger than required size and reminder > l_size, split the
  *  block and insert the splited block in to free class of its size
  */
-void *place(size_t size,void *bp){
+static void *place(size_t size,void *bp){
+    PROF_PHASE(MM_PROF_PLACE);
     //int bound= find_bound(size);
     size_t b_size = GET_SIZE(HDRP(bp));
     size_t split_size = b_size-size;
@@ -283,17 +821,20 @@ void *place(size_t size,void *bp){
 
         PUT(HDRP(bp),PACK(b_size,1));
         PUT(FTRP(bp),PACK(b_size,1));
+        META_BLOCK(bp,b_size,1);
     }
 
     else{
 
         PUT(HDRP(bp),PACK(size,1));
         PUT(FTRP(bp),PACK(size,1));
+        META_BLOCK(bp,size,1);
 
         assert(NEXT_BLKP(bp) != NULL);
 
         PUT(HDRP(NEXT_BLKP(bp)),PACK(split_size,0));
         PUT(FTRP(NEXT_BLKP(bp)),PACK(split_size,0));
+        META_BLOCK(NEXT_BLKP(bp),split_size,0);
 
         insert(split_size,NEXT_BLKP(bp));
         coalesce(NEXT_BLKP(bp));
@@ -308,11 +849,26 @@ void *place(size_t size,void *bp){
 /* unlink the given ptr with its next and prev
  *   if there is any!
  */
-void unlink_blk(void *ptr){
+static void unlink_blk(void *ptr){
+    PROF_PHASE(MM_PROF_UNLINK);
     int bound=find_bound(GET_SIZE(HDRP(ptr)));
     void* next=NEXT(ptr);
     void* prev=PREV(ptr);
 
+#if FIT_POLICY == FIT_NEXT
+    if (rover[bound]==ptr){
+        rover[bound]=next;
+    }
+#endif
+#if SKIP_LISTS
+    if (skip_on[bound]){
+        skip_unlink(bound,ptr);
+    }
+    if (--seg_len[bound]<SKIP_THRESHOLD/4){
+        skip_on[bound]=0;
+    }
+#endif
+
     if ((prev==NULL)&&(next==NULL)){
         seg[bound]=NULL;
     }
@@ -344,13 +900,27 @@ void unlink_blk(void *ptr){
  *   (since bp is free we know for sure), coalesce them
  *   into a larger chunk and insert into proper size class
  */
-void coalesce(void *bp){
+static void coalesce(void *bp){
+    PROF_PHASE(MM_PROF_COALESCE);
     size_t total_size=GET_SIZE(HDRP(bp));
     char *prev;
     char *next;
     int nalloc;
     int palloc;
 
+#ifdef META_BITMAP
+    /* Neighbour state comes from the side table; the tags of prev are
+     * only read once we know it has to be merged */
+    palloc=meta_test(meta_alloc,GRAN(bp)-1);
+    nalloc=meta_test(meta_alloc,GRAN(bp)+total_size/DSIZE);
+
+    if (palloc&&nalloc){
+        return;
+    }
+
+    prev=palloc ? NULL : PREV_BLKP(bp);
+    next=NEXT_BLKP(bp);
+#else
     prev=PREV_BLKP(bp);
     next=NEXT_BLKP(bp);
 
@@ -360,6 +930,7 @@ void coalesce(void *bp){
     if (palloc&&nalloc){
         return;
     }
+#endif
 
     unlink_blk(bp);
 
@@ -368,6 +939,7 @@ void coalesce(void *bp){
         total_size+=GET_SIZE(HDRP(next));
         PUT(HDRP(bp),PACK(total_size,0));
         PUT(FTRP(bp),PACK(total_size,0));
+        META_ABSORB(next);
     }
     else if (!palloc&&nalloc){
 
@@ -375,6 +947,7 @@ void coalesce(void *bp){
         total_size+=GET_SIZE(HDRP(prev));
         PUT(HDRP(prev),PACK(total_size,0));
         PUT(FTRP(prev),PACK(total_size,0));
+        META_ABSORB(bp);
         bp=prev;
     }
 
@@ -385,6 +958,8 @@ void coalesce(void *bp){
         total_size+=GET_SIZE(HDRP(next));
         PUT(HDRP(prev),PACK(total_size,0));
         PUT(FTRP(prev),PACK(total_size,0));
+        META_ABSORB(bp);
+        META_ABSORB(next);
         bp=prev;
     }
 
@@ -396,12 +971,17 @@ void coalesce(void *bp){
  *   Allocate fresh chunk of memory, insert into proper
  *   size class, and return the pointer to it
  */
-void *extend_heap(size_t words){
+static void *extend_heap(size_t words){
+    PROF_PHASE(MM_PROF_EXTEND_HEAP);
     size_t asize;
     unsigned int *new=0;
 
     asize=((words % 2) ? (words+1) * WSIZE : words) * WSIZE;
 
+    /* The heap may be reserved larger than the 4-byte offsets reach */
+    if (mem_heapsize()+asize > HEAP_LIMIT){
+        return NULL;
+    }
     if ((new=mem_sbrk(asize))==(void*)-1){
         return NULL;
     }
@@ -409,6 +989,8 @@ void *extend_heap(size_t words){
     PUT(HDRP(new),PACK(asize,0));
     PUT(FTRP(new),PACK(asize,0));
     PUT(HDRP(NEXT_BLKP(new)), PACK(0, 1));
+    META_BLOCK(new,asize,0);
+    META_BLOCK(NEXT_BLKP(new),DSIZE,1);
 
     insert(asize,new);
     //coalesce(new);
@@ -428,6 +1010,7 @@ void *extend_heap(size_t words){
  * Else, expend the heap, allocate, and return pointer.
  */
 void *malloc (size_t size) {
+    PROF_PHASE(MM_PROF_MALLOC);
 
     size_t asize;   /* Adjusted block size */
     size_t extendsize;  /* Amount to extend heap if no fit */
@@ -471,6 +1054,7 @@ void *malloc (size_t size) {
  *  Coalesce with adjacent blks.
  */
 void free (void *bp) {
+    PROF_PHASE(MM_PROF_FREE);
     //printf("entered free\n");
 
     //Must be valid address
@@ -493,6 +1077,7 @@ void free (void *bp) {
 
     PUT(HDRP(bp),PACK(size, 0));
     PUT(FTRP(bp),PACK(size, 0));
+    META_BLOCK(bp,size,0);
 
     insert(size,bp);
     coalesce(bp);
@@ -504,6 +1089,7 @@ void free (void *bp) {
  * realloc - you may want to look at mm-naive.c
  */
 void *realloc(void *oldptr, size_t size) {
+    PROF_PHASE(MM_PROF_REALLOC);
     size_t oldsize;
     void *newptr;
 
@@ -526,8 +1112,11 @@ void *realloc(void *oldptr, size_t size) {
     }
 
     /* Copy the old data. */
+    SIM_ACCESS(SIZE_PTR(oldptr), sizeof(size_t), 0);
     oldsize = *SIZE_PTR(oldptr);
     if(size < oldsize) oldsize = size;
+    SIM_ACCESS(oldptr, oldsize, 1);
+    SIM_ACCESS(newptr, oldsize, 1);
     memcpy(newptr, oldptr, oldsize);
 
     /* Free the old block. */
@@ -550,13 +1139,14 @@ void *calloc (size_t nmemb, size_t size)
     void *newptr;
 
     newptr = malloc(bytes);
+    SIM_ACCESS(newptr, bytes, 1);
     memset(newptr, 0, bytes);
 
     return newptr;
 }
 
 
-void printblock(void *bp)
+static void printblock(void *bp)
 {
     size_t hsize, fsize;
     int halloc, falloc;
@@ -572,6 +1162,83 @@ void printblock(void *bp)
 }
 
 
+#ifdef META_BITMAP
+/*
+ * Walk the heap through the side table only, then make sure every
+ * block it finds agrees with its boundary tags.
+ */
+static void check_meta(void){
+    size_t g, next;
+
+    for (g = GRAN(heap_listp); ; g = next){
+        void *bp = GRAN2P(g);
+        int alloc = meta_test(meta_alloc, g);
+
+        next = meta_next_start(g);
+        if (next == 0){
+            if (bp != (char *)mem_heap_hi() + 1 || GET_SIZE(HDRP(bp)) != 0)
+                printf("SIDE TABLE LOSES EPILOGUE AT %p\n", bp);
+            break;
+        }
+
+        if (alloc != (int)GET_ALLOC(HDRP(bp)))
+            printf("SIDE TABLE ALLOC MISMATCH AT %p\n", bp);
+        if ((next - g) * DSIZE != GET_SIZE(HDRP(bp)))
+            printf("SIDE TABLE SIZE MISMATCH AT %p: %zu vs %u\n",
+                   bp, (next - g) * DSIZE, GET_SIZE(HDRP(bp)));
+        if (meta_test(meta_alloc, next - 1) != alloc)
+            printf("SIDE TABLE PARTIAL BLOCK AT %p\n", bp);
+    }
+}
+#endif
+
+#if SKIP_LISTS
+/*
+ * Every class must be ordered and hold seg_len blocks. In a skip class
+ * every level must be an ordered sublist of the levels below it.
+ */
+static void check_skip(void){
+    for (int i=0; i<class; i++){
+        int len=0;
+
+        for (void* bp=seg[i];bp!=NULL;bp=NEXT(bp)){
+            void *next=NEXT(bp);
+            len++;
+            if (next!=NULL && class_less(i,next,GET_SIZE(HDRP(bp)),bp)){
+                printf("CLASS %d OUT OF ORDER\n",i);
+            }
+        }
+        if (len!=seg_len[i]){
+            printf("CLASS %d LENGTH %d, COUNTED %d\n",i,seg_len[i],len);
+        }
+        if (!skip_on[i]){
+            continue;
+        }
+
+        for (int l=1; l<skip_top[i]; l++){
+            void *below=seg[i];
+            for (void* bp=skip_head[i][l];bp!=NULL;
+                 bp=skip_next(i,bp,l)){
+                void *next=skip_next(i,bp,l);
+                if ((int)SKIP_HEIGHT(bp)<=l){
+                    printf("SKIP LEVEL %d OF CLASS %d HAS A SHORT BLOCK\n",l,i);
+                }
+                if (next!=NULL && !key_less(bp,GET_SIZE(HDRP(next)),next)){
+                    printf("SKIP LEVEL %d OF CLASS %d OUT OF ORDER\n",l,i);
+                }
+                while (below!=NULL && below!=bp){
+                    below=NEXT(below);
+                }
+                if (below==NULL){
+                    printf("SKIP LEVEL %d OF CLASS %d NOT IN LIST\n",l,i);
+                    break;
+                }
+            }
+        }
+    }
+}
+#endif
+
 /*
  * mm_checkheap
  */
@@ -646,5 +1313,41 @@ void mm_checkheap(int verbose) {
             }
         }
     }
+
+#if SKIP_LISTS
+    check_skip();
+#endif
+
+#ifdef META_BITMAP
+    check_meta();
+#endif
 }
 
+/*
+ * mm_footprint - Report the free space of the heap, by walking the
+ * segregated lists; the lists' classes are the footprint's classes.
+ */
+void mm_footprint(mm_footprint_t *fp){
+    size_t size;
+
+    memset(fp, 0, sizeof(*fp));
+    fp->nclasses = class;
+    for (int i=0; i<class; i++){
+        for (void* bp=seg[i];bp!=NULL;bp=NEXT(bp)){
+            size = GET_SIZE(HDRP(bp));
+            fp->class_free[i] += size;
+            fp->free_bytes += size;
+            if (size > fp->largest_free)
+                fp->largest_free = size;
+        }
+    }
+}
+
+#ifdef MM_PROFILE
+/*
+ * mm_profile - Report the calls, self cycles and probes since mm_init
+ */
+void mm_profile(mm_profile_t *p){
+    *p = prof;
+}
+#endif
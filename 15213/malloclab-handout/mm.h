@@ -1,3 +1,6 @@
+#ifndef __MM_H__
+#define __MM_H__
+
 #include <stdio.h>
 
 #ifdef DRIVER
@@ -23,3 +26,38 @@ extern int mm_init(void);
 /* This is largely for debugging.  You can do what you want with the
    verbose flag; we don't care. */
 extern void mm_checkheap(int verbose);
+
+/* The free space in the heap, as reported by mm_footprint. Free bytes
+   are counted by size class, class i holding the free blocks of
+   2^i up to 2^(i+1)-1 bytes; mdriver samples this for its footprint
+   timeline (--timeline). */
+#define MM_FP_CLASSES 32
+typedef struct {
+    size_t free_bytes;                  /* bytes in free blocks */
+    size_t largest_free;                /* size of the largest free block */
+    int nclasses;                       /* size classes in use */
+    size_t class_free[MM_FP_CLASSES];   /* free bytes in each class */
+} mm_footprint_t;
+
+extern void mm_footprint(mm_footprint_t *fp);
+
+/* The profile of a build of mm.c with -DMM_PROFILE, as reported by
+   mm_profile: the calls and the self cycles (excluding the phases it
+   calls) of each entry point and phase, and the free blocks stepped
+   over by find_fit and by the ordered insert. mdriver --profile
+   prints it for each trace. */
+enum { MM_PROF_MALLOC, MM_PROF_FREE, MM_PROF_REALLOC, MM_PROF_FIND_FIT,
+       MM_PROF_PLACE, MM_PROF_INSERT, MM_PROF_UNLINK, MM_PROF_COALESCE,
+       MM_PROF_EXTEND_HEAP, MM_PROF_PHASES };
+#define MM_PROF_NAMES { "malloc", "free", "realloc", "find_fit", "place", \
+                        "insert", "unlink_blk", "coalesce", "extend_heap" }
+typedef struct {
+    unsigned long calls[MM_PROF_PHASES];
+    unsigned long long cycles[MM_PROF_PHASES];
+    unsigned long fit_probes;       /* free blocks looked at by find_fit */
+    unsigned long insert_probes;    /* free blocks passed by insert */
+} mm_profile_t;
+
+extern void mm_profile(mm_profile_t *p);
+
+#endif /* __MM_H__ */
@@ -0,0 +1,148 @@
+/*
+ * mm_pmr.hpp - C++ adapters for the mm malloc package
+ *
+ * mm::resource is a std::pmr::memory_resource that hands out blocks
+ * from mm_malloc/mm_free, so std::pmr containers can run on top of
+ * mm.c. mm::allocator<T> is the same thing as a plain STL allocator.
+ *
+ * mm.c only guarantees ALIGNMENT (8) byte alignment. Larger alignments
+ * are served by over-allocating and keeping the pointer returned by
+ * mm_malloc in the word just below the aligned block.
+ *
+ * The mm package has a single heap, so every mm::resource (and every
+ * mm::allocator) can free memory obtained from any other one. The
+ * simulated heap must be set up with mm::init() before first use.
+ */
+#ifndef __MM_PMR_HPP__
+#define __MM_PMR_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+extern "C" {
+#include "mm.h"
+#include "memlib.h"
+}
+
+namespace mm {
+
+/* Alignment that mm_malloc guarantees on its own */
+constexpr std::size_t min_align = 8;
+
+/* init - Start a fresh simulated heap and mm package. Returns false
+ * if mm_init fails. */
+inline bool init()
+{
+    static bool mem_ready = false;
+    if (!mem_ready) {
+        mem_init();
+        mem_ready = true;
+    }
+    mem_reset_brk();
+    return mm_init() >= 0;
+}
+
+/* aligned_malloc - Return a block of bytes aligned to align (a power
+ * of two), or NULL */
+inline void *aligned_malloc(std::size_t bytes, std::size_t align)
+{
+    if (align <= min_align)
+        return mm_malloc(bytes);
+
+    char *raw = static_cast<char *>(mm_malloc(bytes + align));
+    if (raw == NULL)
+        return NULL;
+
+    /* Always move up by at least one word to make room for raw */
+    std::uintptr_t p = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void *);
+    p = (p + align - 1) & ~(std::uintptr_t)(align - 1);
+    reinterpret_cast<void **>(p)[-1] = raw;
+    return reinterpret_cast<void *>(p);
+}
+
+/* aligned_free - Free a block from aligned_malloc with the same align */
+inline void aligned_free(void *p, std::size_t align)
+{
+    if (p == NULL)
+        return;
+    if (align <= min_align)
+        mm_free(p);
+    else
+        mm_free(static_cast<void **>(p)[-1]);
+}
+
+/*
+ * resource - std::pmr::memory_resource backed by the mm package
+ */
+class resource : public std::pmr::memory_resource {
+private:
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        void *p = aligned_malloc(bytes == 0 ? 1 : bytes, align);
+        if (p == NULL)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes __attribute__((unused)),
+                       std::size_t align) override
+    {
+        aligned_free(p, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const resource *>(&other) != NULL;
+    }
+};
+
+/* default_resource - A shared mm::resource instance */
+inline resource *default_resource()
+{
+    static resource r;
+    return &r;
+}
+
+/*
+ * allocator - STL allocator backed by the mm package
+ */
+template <class T>
+struct allocator {
+    typedef T value_type;
+
+    allocator() noexcept {}
+    template <class U> allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T))
+            throw std::bad_array_new_length();
+        void *p = aligned_malloc(n == 0 ? 1 : n * sizeof(T), alignof(T));
+        if (p == NULL)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n __attribute__((unused))) noexcept
+    {
+        aligned_free(p, alignof(T));
+    }
+};
+
+template <class T, class U>
+inline bool operator==(const allocator<T> &, const allocator<U> &) noexcept
+{
+    return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const allocator<T> &, const allocator<U> &) noexcept
+{
+    return false;
+}
+
+} /* namespace mm */
+
+#endif /* __MM_PMR_HPP__ */
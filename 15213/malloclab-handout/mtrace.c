@@ -0,0 +1,279 @@
+/*
+ * mtrace.c - Record the allocation calls of a running program
+ *
+ * Built as libmtrace.so and loaded with LD_PRELOAD, this wraps the libc
+ * malloc, free, realloc, calloc and the aligned allocators, and logs
+ * every call to the file named by $MTRACE_FILE (default
+ * mtrace.<pid>.log). trconv turns the log into an mdriver trace:
+ *
+ *   LD_PRELOAD=./libmtrace.so MTRACE_FILE=prog.log ./prog
+ *   ./trconv prog.log prog.rep
+ *
+ * Each thread logs into its own buffer, so the fast path takes no
+ * lock; a full buffer is written out in one write() under a mutex, and
+ * the buffers of the threads still running are written out at exit.
+ * Every event carries a small thread number (in order of each thread's
+ * first call) and a sequence number from one global counter. An
+ * allocation takes its number after the call returns, and a free
+ * before the call, so a block is always numbered after the free that
+ * released its memory, whatever threads the two ran on.
+ *
+ * The real allocator is reached through glibc's __libc_* entry points
+ * rather than dlsym, which itself allocates. Forked children stop
+ * logging.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tracefmt.h"
+
+#define MT_BUF_EVENTS  4096    /* events buffered per thread (128KB) */
+
+/* The allocator in glibc */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+
+/* A thread's event buffer */
+typedef struct mt_buf {
+    tf_event_t ev[MT_BUF_EVENTS];
+    int n;
+    uint16_t tid;
+    struct mt_buf *prev, *next;     /* all live buffers */
+} mt_buf_t;
+
+static int mt_fd = -1;              /* the log, -1 when not logging */
+static uint64_t mt_seq;             /* next sequence number */
+static uint16_t mt_ntids;           /* threads seen so far */
+static mt_buf_t *mt_bufs;           /* buffers of the running threads */
+static pthread_mutex_t mt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t mt_key;
+
+static __thread mt_buf_t *mt_self;  /* this thread's buffer */
+static __thread int mt_busy;        /* set while inside the recorder */
+
+/* mt_write - Append n bytes to the log; the caller holds mt_lock */
+static void mt_write(const void *buf, size_t n)
+{
+    const char *p = buf;
+    ssize_t w;
+
+    while (n > 0) {
+        if ((w = write(mt_fd, p, n)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return;     /* nothing sensible to do; drop the events */
+        }
+        p += w;
+        n -= w;
+    }
+}
+
+/* mt_flush - Write out a buffer's events */
+static void mt_flush(mt_buf_t *b)
+{
+    pthread_mutex_lock(&mt_lock);
+    if (mt_fd >= 0 && b->n > 0)
+        mt_write(b->ev, b->n * sizeof(tf_event_t));
+    b->n = 0;
+    pthread_mutex_unlock(&mt_lock);
+}
+
+/* mt_thread_exit - Flush and release an exiting thread's buffer */
+static void mt_thread_exit(void *arg)
+{
+    mt_buf_t *b = arg;
+
+    mt_flush(b);
+    pthread_mutex_lock(&mt_lock);
+    if (b->prev)
+        b->prev->next = b->next;
+    else
+        mt_bufs = b->next;
+    if (b->next)
+        b->next->prev = b->prev;
+    pthread_mutex_unlock(&mt_lock);
+    mt_self = NULL;
+    __libc_free(b);
+}
+
+/* mt_buf - Return this thread's buffer, creating it on first use */
+static mt_buf_t *mt_buf(void)
+{
+    mt_buf_t *b;
+
+    if ((b = mt_self) != NULL)
+        return b;
+    if ((b = __libc_malloc(sizeof(mt_buf_t))) == NULL)
+        return NULL;
+    b->n = 0;
+    b->prev = NULL;
+    pthread_mutex_lock(&mt_lock);
+    b->tid = mt_ntids++;
+    b->next = mt_bufs;
+    if (mt_bufs)
+        mt_bufs->prev = b;
+    mt_bufs = b;
+    pthread_mutex_unlock(&mt_lock);
+    pthread_setspecific(mt_key, b);
+    return mt_self = b;
+}
+
+/* mt_record - Log one call */
+static void mt_record(int type, void *ptr, void *old, size_t size,
+                      uint64_t seq)
+{
+    mt_buf_t *b;
+    tf_event_t *e;
+
+    mt_busy = 1;
+    if ((b = mt_buf()) != NULL) {
+        e = &b->ev[b->n];
+        e->seq = seq;
+        e->ptr = (uintptr_t)ptr;
+        e->old = (uintptr_t)old;
+        e->size = size > UINT32_MAX ? UINT32_MAX : size;
+        e->type = type;
+        e->tid = b->tid;
+        if (++b->n == MT_BUF_EVENTS)
+            mt_flush(b);
+    }
+    mt_busy = 0;
+}
+
+/* mt_on - Is this call to be logged? */
+static inline int mt_on(void)
+{
+    return mt_fd >= 0 && !mt_busy;
+}
+
+static inline uint64_t mt_next_seq(void)
+{
+    return __atomic_fetch_add(&mt_seq, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * The wrappers
+ */
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+
+    if (mt_on())
+        mt_record(TF_ALLOC, p, NULL, size, mt_next_seq());
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+
+    if (mt_on())
+        mt_record(TF_ALLOC, p, NULL, nmemb * size, mt_next_seq());
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL && mt_on())
+        mt_record(TF_FREE, ptr, NULL, 0, mt_next_seq());
+    __libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p = __libc_realloc(ptr, size);
+
+    if (mt_on())
+        mt_record(TF_REALLOC, p, ptr, size, mt_next_seq());
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p = __libc_memalign(align, size);
+
+    if (mt_on())
+        mt_record(TF_ALLOC, p, NULL, size, mt_next_seq());
+    return p;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    return memalign(align, size);
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+        return EINVAL;
+    if ((p = memalign(align, size)) == NULL && size != 0)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+/*
+ * Setup and teardown
+ */
+static void mt_fork_child(void)
+{
+    mt_fd = -1;
+}
+
+__attribute__((constructor))
+static void mt_start(void)
+{
+    char name[64];
+    const char *file = getenv("MTRACE_FILE");
+    tf_log_header_t hdr;
+    int fd;
+
+    if (file == NULL) {
+        snprintf(name, sizeof(name), "mtrace.%d.log", (int)getpid());
+        file = name;
+    }
+    if ((fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(file);
+        return;
+    }
+
+    pthread_key_create(&mt_key, mt_thread_exit);
+    pthread_atfork(NULL, NULL, mt_fork_child);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TF_LOG_MAGIC, sizeof(hdr.magic));
+    hdr.version = TF_VERSION;
+    hdr.byte_order = TF_BYTE_ORDER;
+    mt_fd = fd;
+    mt_write(&hdr, sizeof(hdr));
+}
+
+__attribute__((destructor))
+static void mt_stop(void)
+{
+    mt_buf_t *b;
+    int fd = mt_fd;
+
+    if (fd < 0)
+        return;
+    mt_busy = 1;
+    pthread_mutex_lock(&mt_lock);
+    for (b = mt_bufs; b != NULL; b = b->next) {
+        mt_write(b->ev, b->n * sizeof(tf_event_t));
+        b->n = 0;
+    }
+    mt_fd = -1;
+    pthread_mutex_unlock(&mt_lock);
+    close(fd);
+}
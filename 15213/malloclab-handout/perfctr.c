@@ -0,0 +1,150 @@
+/*
+ * perfctr.c - Hardware performance counters (see perfctr.h)
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+
+const char *pc_names[PC_NUM] = {
+    "cycles", "instructions", "L1D-misses", "LLC-misses",
+    "dTLB-misses", "branch-misses"
+};
+
+static char pc_errbuf[128] = "not supported on this system";
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct { uint32_t type; uint64_t config; } pc_events[PC_NUM] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+                                      PERF_COUNT_HW_CACHE_OP_READ,
+                                      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+                                      PERF_COUNT_HW_CACHE_OP_READ,
+                                      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+/*
+ * pc_open - Open every counter the kernel allows, stopped and zeroed.
+ *     Returns the number opened; if none, pc_error says why.
+ */
+int pc_open(perfctr_t *pc)
+{
+    struct perf_event_attr attr;
+    int i, n = 0, err = 0;
+
+    for (i = 0; i < PC_NUM; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = pc_events[i].type;
+        attr.config = pc_events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (pc->fd[i] >= 0)
+            n++;
+        else if (err == 0)
+            err = errno;
+    }
+    if (n == 0) {
+        if (err == EACCES || err == EPERM)
+            snprintf(pc_errbuf, sizeof(pc_errbuf), "%s (see "
+                     "/proc/sys/kernel/perf_event_paranoid)", strerror(err));
+        else
+            snprintf(pc_errbuf, sizeof(pc_errbuf), "%s", strerror(err));
+    }
+    pc_reset(pc);
+    return n;
+}
+
+/* pc_start - Start counting */
+void pc_start(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++) {
+        if (pc->fd[i] < 0)
+            continue;
+        ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+/*
+ * pc_stop - Stop counting, and add the counts since pc_start to the
+ *     values. When the kernel had to multiplex the counters, a count is
+ *     scaled up by the fraction of the time its counter was running.
+ */
+void pc_stop(perfctr_t *pc)
+{
+    uint64_t buf[3];    /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+        if (pc->fd[i] >= 0)
+            ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PC_NUM; i++) {
+        if (pc->fd[i] < 0 || read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf))
+            continue;
+        if (buf[2] > 0 && buf[2] < buf[1])
+            buf[0] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+        pc->value[i] += buf[0];
+    }
+}
+
+/* pc_close - Close the counters */
+void pc_close(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++) {
+        if (pc->fd[i] >= 0)
+            close(pc->fd[i]);
+        pc->fd[i] = -1;
+    }
+}
+
+#else /* !__linux__ */
+
+int pc_open(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+        pc->fd[i] = -1;
+    pc_reset(pc);
+    return 0;
+}
+
+void pc_start(perfctr_t *pc) { (void)pc; }
+void pc_stop(perfctr_t *pc) { (void)pc; }
+void pc_close(perfctr_t *pc) { (void)pc; }
+
+#endif /* __linux__ */
+
+/* pc_reset - Zero the values */
+void pc_reset(perfctr_t *pc)
+{
+    memset(pc->value, 0, sizeof(pc->value));
+}
+
+/* pc_error - Say why pc_open found no counters */
+const char *pc_error(void)
+{
+    return pc_errbuf;
+}
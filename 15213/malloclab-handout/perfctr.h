@@ -0,0 +1,40 @@
+/*
+ * perfctr.h - Hardware performance counters
+ *
+ * A small wrapper around Linux perf_event_open for counting what one
+ * piece of code does to the machine: cycles, instructions, L1D and
+ * last-level cache misses, dTLB misses and branch mispredicts. Only
+ * user-mode events of the calling thread are counted.
+ *
+ * Every counter is opened on its own, so a machine or VM that lacks
+ * one event still reports the others. When the kernel refuses them
+ * all (perf_event_paranoid, seccomp, or not Linux), pc_open returns 0
+ * and the counters read as unavailable.
+ */
+#ifndef __PERFCTR_H__
+#define __PERFCTR_H__
+
+#include <stdint.h>
+
+/* The events counted */
+enum {
+    PC_CYCLES, PC_INSTRUCTIONS, PC_L1D_MISSES, PC_LLC_MISSES,
+    PC_DTLB_MISSES, PC_BRANCH_MISSES,
+    PC_NUM
+};
+
+typedef struct {
+    int fd[PC_NUM];         /* -1 if the event is unavailable */
+    uint64_t value[PC_NUM]; /* counts since the last pc_reset */
+} perfctr_t;
+
+extern const char *pc_names[PC_NUM];
+
+int pc_open(perfctr_t *pc);
+void pc_close(perfctr_t *pc);
+void pc_reset(perfctr_t *pc);
+void pc_start(perfctr_t *pc);
+void pc_stop(perfctr_t *pc);
+const char *pc_error(void);
+
+#endif /* __PERFCTR_H__ */
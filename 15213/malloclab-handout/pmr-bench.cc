@@ -0,0 +1,221 @@
+/*
+ * pmr-bench.cc - Container benchmarks for the mm package
+ *
+ * Runs std::pmr::vector, std::pmr::unordered_map and std::pmr::list
+ * workloads on top of mm.c (through mm::resource), the default memory
+ * resource, and a monotonic_buffer_resource, and reports container
+ * operations per second. The list workload also runs with
+ * mm::allocator<T> to compare the plain STL allocator path.
+ *
+ * Timing uses the same fsecs package as mdriver, so the numbers
+ * follow the K-best scheme selected in config.h.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "mm_pmr.hpp"
+
+extern "C" {
+#include "fsecs.h"
+}
+
+/* fsecs.c reads mdriver's verbosity flag */
+extern "C" int verbose;
+int verbose = 0;
+
+/* Workload sizes */
+#define VEC_ROUNDS  64      /* vectors built per run */
+#define VEC_LEN     4096    /* push_backs per vector */
+#define MAP_KEYS    (1<<15) /* distinct keys in the map workload */
+#define LIST_LEN    (1<<15) /* nodes in the list workload */
+
+/* Memory resources under test */
+enum { RES_MM, RES_MM_ALLOC, RES_DEFAULT, RES_MONOTONIC, NUM_RES };
+static const char *res_names[NUM_RES] = {
+    "mm::resource", "mm::allocator", "default", "monotonic"
+};
+
+/* Holds the params to a timed workload */
+typedef struct {
+    int workload;
+    int res;
+} bench_t;
+
+static volatile long sink; /* keeps results live */
+
+/*
+ * The workloads. Each returns the number of container operations it
+ * performed, which is what ops/sec is counted in.
+ */
+template <class Vec>
+static double vector_body(Vec &v)
+{
+    double ops = 0;
+    for (int i = 0; i < VEC_LEN; i++)
+        v.push_back(i);
+    ops += VEC_LEN;
+    while (!v.empty()) {
+        sink += v.back();
+        v.pop_back();
+    }
+    return ops + VEC_LEN;
+}
+
+template <class Map>
+static double map_body(Map &m)
+{
+    int i;
+    for (i = 0; i < MAP_KEYS; i++)
+        m[i * 7919] = i;
+    for (i = 0; i < MAP_KEYS; i += 2)
+        m.erase(i * 7919);
+    for (i = 0; i < MAP_KEYS; i++)
+        sink += m.count(i * 7919);
+    for (i = 0; i < MAP_KEYS; i += 2)
+        m[i * 7919] = i;
+    return 3.0 * MAP_KEYS;
+}
+
+template <class List>
+static double list_body(List &l)
+{
+    int i;
+    for (i = 0; i < LIST_LEN; i++)
+        l.push_back(i);
+    /* free every other node, then refill the holes */
+    for (auto it = l.begin(); it != l.end(); ) {
+        it = l.erase(it);
+        if (it != l.end())
+            ++it;
+    }
+    for (i = 0; i < LIST_LEN / 2; i++)
+        l.push_front(i);
+    sink += l.size();
+    return 2.0 * LIST_LEN;
+}
+
+static double run_vector(std::pmr::memory_resource *r)
+{
+    double ops = 0;
+    for (int k = 0; k < VEC_ROUNDS; k++) {
+        std::pmr::vector<int> v(r);
+        ops += vector_body(v);
+    }
+    return ops;
+}
+
+static double run_map(std::pmr::memory_resource *r)
+{
+    std::pmr::unordered_map<int, int> m(r);
+    return map_body(m);
+}
+
+static double run_list(std::pmr::memory_resource *r)
+{
+    std::pmr::list<int> l(r);
+    return list_body(l);
+}
+
+static double run_list_alloc(void)
+{
+    std::list<int, mm::allocator<int> > l;
+    return list_body(l);
+}
+
+/* Workload table */
+typedef double (*workload_funct)(std::pmr::memory_resource *);
+static const struct {
+    const char *name;
+    workload_funct run;
+} workloads[] = {
+    { "vector", run_vector },
+    { "unordered_map", run_map },
+    { "list", run_list },
+};
+#define NUM_WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+/*
+ * run_bench - One timed run of a workload on a resource. This is the
+ *     function timed by fsecs; it returns its op count through ops.
+ */
+static double last_ops;
+
+static void run_bench(void *argp)
+{
+    bench_t *b = (bench_t *)argp;
+
+    switch (b->res) {
+    case RES_MM:
+        if (!mm::init()) {
+            fprintf(stderr, "mm_init failed\n");
+            exit(1);
+        }
+        last_ops = workloads[b->workload].run(mm::default_resource());
+        break;
+
+    case RES_MM_ALLOC:
+        if (!mm::init()) {
+            fprintf(stderr, "mm_init failed\n");
+            exit(1);
+        }
+        last_ops = run_list_alloc();
+        break;
+
+    case RES_DEFAULT:
+        last_ops = workloads[b->workload].run(std::pmr::get_default_resource());
+        break;
+
+    case RES_MONOTONIC: {
+        std::pmr::monotonic_buffer_resource mono(std::pmr::get_default_resource());
+        last_ops = workloads[b->workload].run(&mono);
+        break;
+    }
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: pmr-bench [-h] [-v]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-v         Print timer diagnostics.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    bench_t b;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) {
+            verbose = 1;
+        } else {
+            usage();
+            exit(strcmp(argv[i], "-h") ? 1 : 0);
+        }
+    }
+
+    init_fsecs();
+
+    printf("%-14s %-14s %10s %10s\n", "workload", "resource", "secs", "Kops");
+    for (b.workload = 0; b.workload < NUM_WORKLOADS; b.workload++) {
+        for (b.res = 0; b.res < NUM_RES; b.res++) {
+            double secs;
+
+            /* mm::allocator is only wired up for the list workload */
+            if (b.res == RES_MM_ALLOC &&
+                workloads[b.workload].run != run_list)
+                continue;
+
+            secs = fsecs(run_bench, &b);
+            printf("%-14s %-14s %10.6f %10.0f\n", workloads[b.workload].name,
+                   res_names[b.res], secs, (last_ops / 1e3) / secs);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,5 @@
+# Bimodal sizes: small objects mixed with 5% large buffers
+ops      20000
+seed     2
+sizes    bimodal 8 128 16384 131072 0.05
+lifetime exp 100
@@ -0,0 +1,7 @@
+# A long-lived cache with churn: 10% of the blocks live ~50x longer,
+# with the live set held at 8MB
+ops      40000
+seed     3
+peak     8388608
+sizes    powerlaw 32 8192 1.3
+lifetime bimodal 50 2500 0.1
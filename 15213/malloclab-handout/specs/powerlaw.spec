@@ -0,0 +1,5 @@
+# Power-law sizes: mostly small blocks with a long tail of large ones
+ops      20000
+seed     1
+sizes    powerlaw 8 65536 1.8
+lifetime exp 200
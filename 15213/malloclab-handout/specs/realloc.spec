@@ -0,0 +1,7 @@
+# Realloc growth chains: live buffers repeatedly grown by 1.5x
+ops      20000
+seed     4
+peak     33554432
+sizes    uniform 16 512
+lifetime exp 400
+realloc  0.3 1.5
@@ -0,0 +1,97 @@
+/*
+ * tracefmt.c - Map binary traces into memory (see tracefmt.h)
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tracefmt.h"
+
+/*
+ * tf_is_binary - Return 1 if filename starts with the binary trace
+ *     magic, 0 otherwise (including if it can't be read)
+ */
+int tf_is_binary(const char *filename)
+{
+    char magic[4];
+    int fd, n;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return 0;
+    n = read(fd, magic, sizeof(magic));
+    close(fd);
+    return n == sizeof(magic) && memcmp(magic, TF_MAGIC, sizeof(magic)) == 0;
+}
+
+/*
+ * tf_map - Map the binary trace filename read-only into m. The header
+ *     and every record are checked, so the caller can index blocks
+ *     with the records without further checks. Returns NULL on
+ *     success, or a message saying what is wrong with the file.
+ */
+const char *tf_map(tf_map_t *m, const char *filename)
+{
+    struct stat st;
+    const tf_header_t *hdr;
+    const char *err = NULL;
+    int fd, i;
+
+    memset(m, 0, sizeof(*m));
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return strerror(errno);
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return strerror(errno);
+    }
+    if ((size_t)st.st_size < sizeof(tf_header_t)) {
+        close(fd);
+        return "truncated header";
+    }
+
+    m->map_len = st.st_size;
+    m->map = mmap(NULL, m->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m->map == MAP_FAILED) {
+        m->map = NULL;
+        return strerror(errno);
+    }
+
+    hdr = m->hdr = (const tf_header_t *)m->map;
+    m->ops = (tf_op_t *)(hdr + 1);
+
+    if (memcmp(hdr->magic, TF_MAGIC, sizeof(hdr->magic)) != 0)
+        err = "not a binary trace";
+    else if (hdr->byte_order != TF_BYTE_ORDER)
+        err = "written with a different byte order";
+    else if (hdr->version != TF_VERSION)
+        err = "unsupported version";
+    else if (hdr->num_ids < 0 || hdr->num_ops < 0 ||
+             m->map_len != sizeof(tf_header_t) +
+                           (size_t)hdr->num_ops * sizeof(tf_op_t))
+        err = "file length does not match num_ops";
+
+    for (i = 0; err == NULL && i < hdr->num_ops; i++) {
+        const tf_op_t *op = &m->ops[i];
+        if (op->type > TF_REALLOC || op->index >= hdr->num_ids ||
+            op->index < (op->type == TF_FREE ? -1 : 0))
+            err = "request with a bad type or index";
+    }
+
+    if (err != NULL)
+        tf_unmap(m);
+    return err;
+}
+
+/*
+ * tf_unmap - Release a trace mapped by tf_map
+ */
+void tf_unmap(tf_map_t *m)
+{
+    if (m->map != NULL)
+        munmap(m->map, m->map_len);
+    memset(m, 0, sizeof(*m));
+}
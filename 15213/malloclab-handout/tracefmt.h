@@ -0,0 +1,91 @@
+/*
+ * tracefmt.h - Binary trace format
+ *
+ * A binary trace holds the same information as a .rep file:
+ *
+ *   tf_header_t                fixed 32-byte header
+ *   tf_op_t ops[num_ops]       one fixed 8-byte record per request
+ *
+ * The records are laid out exactly as mdriver keeps its requests in
+ * memory, so mdriver maps the file and uses the records in place, with
+ * no parsing or copying. That is why the records are fixed size
+ * rather than varint or delta encoded: a variable-length encoding is
+ * smaller on disk, but it has to be decoded (into a copy) before the
+ * driver can index request i directly, which is the cost this format
+ * exists to avoid. At 8 bytes a record is already half the size of
+ * the old in-memory request.
+ *
+ * Records use native byte order and bitfield layout; the header's
+ * byte_order word lets a reader reject a file written on a machine
+ * that disagrees. trconv converts between .rep and this format.
+ *
+ * The allocation logs written by libmtrace.so (mtrace.c) are a second,
+ * raw format: a tf_log_header_t, then tf_event_t records holding
+ * pointers instead of block ids, in per-thread chunks. trconv turns a
+ * log into a trace.
+ */
+#ifndef __TRACEFMT_H__
+#define __TRACEFMT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TF_MAGIC      "MTRC"       /* first four bytes of a binary trace */
+#define TF_VERSION    1
+#define TF_BYTE_ORDER 0x01020304
+#define TF_MAX_SIZE   ((1u << 30) - 1) /* largest request size a record holds */
+
+/* Request types */
+enum tf_type { TF_ALLOC, TF_FREE, TF_REALLOC };
+
+/* The file header */
+typedef struct {
+    char magic[4];          /* TF_MAGIC */
+    uint32_t version;       /* TF_VERSION */
+    uint32_t byte_order;    /* TF_BYTE_ORDER, as written */
+    int32_t weight;         /* the four .rep header fields */
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t ignore_ranges;
+    uint32_t reserved;
+} tf_header_t;
+
+/* One request */
+typedef struct {
+    uint32_t type : 2;      /* enum tf_type */
+    uint32_t size : 30;     /* byte size of alloc/realloc request */
+    int32_t index;          /* block index; -1 is the null pointer */
+} tf_op_t;
+
+/* A binary trace mapped into memory */
+typedef struct {
+    const tf_header_t *hdr;
+    tf_op_t *ops;           /* read-only, despite the type */
+    void *map;
+    size_t map_len;
+} tf_map_t;
+
+/* The raw allocation log header */
+#define TF_LOG_MAGIC  "MTRL"
+typedef struct {
+    char magic[4];          /* TF_LOG_MAGIC */
+    uint32_t version;       /* TF_VERSION */
+    uint32_t byte_order;    /* TF_BYTE_ORDER, as written */
+    uint32_t reserved;
+} tf_log_header_t;
+
+/* One logged call; ordered across threads by seq */
+typedef struct {
+    uint64_t seq;           /* global call order */
+    uint64_t ptr;           /* block returned, or freed */
+    uint64_t old;           /* block passed to realloc */
+    uint32_t size;          /* requested size, saturated at UINT32_MAX */
+    uint16_t type;          /* enum tf_type */
+    uint16_t tid;           /* small per-process thread number */
+} tf_event_t;
+
+int tf_is_binary(const char *filename);
+const char *tf_map(tf_map_t *m, const char *filename);
+void tf_unmap(tf_map_t *m);
+
+#endif /* __TRACEFMT_H__ */
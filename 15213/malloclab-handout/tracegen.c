@@ -0,0 +1,451 @@
+/*
+ * tracegen.c - Generate synthetic mdriver traces from a workload spec
+ *
+ * The spec is a text file of "key value..." lines; "#" starts a
+ * comment. Keys (defaults in brackets):
+ *
+ *   ops <n>                     about how many requests to write [10000]
+ *   seed <n>                    random seed, overridden by -s [1]
+ *   peak <bytes>                cap on live payload bytes [16MB]
+ *   weight <0-3>                trace weight in the header [0]
+ *   sizes fixed <n>
+ *   sizes uniform <min> <max>
+ *   sizes powerlaw <min> <max> <alpha>
+ *                               P(size) ~ size^-alpha on [min, max]
+ *   sizes bimodal <min> <max> <min> <max> <p>
+ *                               uniform small sizes, or with
+ *                               probability p uniform large ones
+ *                               [sizes powerlaw 16 4096 1.5]
+ *   lifetime exp <mean>         lifetimes in requests [lifetime exp 100]
+ *   lifetime uniform <min> <max>
+ *   lifetime bimodal <mean> <mean> <p>
+ *                               exponential short lifetimes, or with
+ *                               probability p long ones (a cache
+ *                               with churn)
+ *   realloc <p> <growth>        each request is, with probability p, a
+ *                               realloc growing a live block by the
+ *                               factor growth; repeated reallocs of a
+ *                               block form growth chains [realloc 0 1]
+ *
+ * Each step frees the block that is due soonest if it is due, and
+ * otherwise reallocs or allocates. A new block that would take the
+ * live bytes past peak first frees the blocks due soonest. Once the
+ * requests written plus the blocks still live reach ops, the live
+ * blocks are freed in order, so the trace ends with an empty heap.
+ *
+ * Every block gets a fresh id, so the header invariants hold by
+ * construction: ids are 0..num_ids-1 and num_ops is the number of
+ * requests written.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAXLINE 1024
+
+/* Distribution kinds */
+enum { D_FIXED, D_UNIFORM, D_POWERLAW, D_BIMODAL, D_EXP };
+
+/* A distribution and its parameters */
+typedef struct {
+    int kind;
+    double a, b, c, d, p;
+} dist_t;
+
+/* The workload spec */
+typedef struct {
+    long ops;
+    unsigned long seed;
+    double peak;
+    int weight;
+    dist_t sizes;
+    dist_t lifetime;
+    double realloc_p;
+    double growth;
+} spec_t;
+
+/* One request of the generated trace */
+typedef struct {
+    char type;      /* 'a', 'f' or 'r' */
+    int id;
+    long size;
+} req_t;
+
+/* The state of the generator */
+static req_t *reqs;         /* requests written so far */
+static long nreqs, max_reqs;
+static int nids;            /* ids handed out so far */
+static int max_ids;
+static long *size_of;       /* by id: current payload size */
+static double *death;       /* by id: request count at which it is freed */
+static int *heap;           /* ids of live blocks, min-heap on death */
+static int nlive;
+static double live_bytes;
+
+static void die(const char *fmt, const char *arg)
+{
+    fprintf(stderr, "tracegen: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t size)
+{
+    if ((p = realloc(p, size)) == NULL)
+        die("%s", "out of memory");
+    return p;
+}
+
+/*
+ * Random numbers: xorshift64*, so a seed gives the same trace with any
+ * libc.
+ */
+static unsigned long long rng_state;
+
+static double urand(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * urand();
+}
+
+static double expo(double mean)
+{
+    return -mean * log(1.0 - urand());
+}
+
+/* sample - Draw from a distribution */
+static double sample(const dist_t *d)
+{
+    double u, e;
+
+    switch (d->kind) {
+    case D_FIXED:
+        return d->a;
+    case D_UNIFORM:
+        return uniform(d->a, d->b + 1);
+    case D_POWERLAW:
+        /* inverse CDF of a power law truncated to [a, b] */
+        u = urand();
+        if (fabs(d->c - 1.0) < 1e-9)
+            return d->a * pow(d->b / d->a, u);
+        e = 1.0 - d->c;
+        return pow(pow(d->a, e) + u * (pow(d->b, e) - pow(d->a, e)), 1.0 / e);
+    case D_BIMODAL:
+        if (urand() < d->p)
+            return uniform(d->c, d->d + 1);
+        return uniform(d->a, d->b + 1);
+    case D_EXP:
+        return expo(d->a);
+    }
+    return 0;
+}
+
+/* lifetime - Draw a lifetime; bimodal lifetimes are exponential */
+static double lifetime(const dist_t *d)
+{
+    if (d->kind == D_BIMODAL)
+        return expo(urand() < d->p ? d->b : d->a);
+    return sample(d);
+}
+
+/*
+ * The live blocks, in a binary min-heap on their death times
+ */
+static void heap_swap(int i, int j)
+{
+    int t = heap[i];
+    heap[i] = heap[j];
+    heap[j] = t;
+}
+
+static void heap_up(int i)
+{
+    while (i > 0 && death[heap[(i - 1) / 2]] > death[heap[i]]) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(int i)
+{
+    int c;
+
+    while ((c = 2 * i + 1) < nlive) {
+        if (c + 1 < nlive && death[heap[c + 1]] < death[heap[c]])
+            c++;
+        if (death[heap[i]] <= death[heap[c]])
+            break;
+        heap_swap(i, c);
+        i = c;
+    }
+}
+
+/* emit - Append a request to the trace */
+static void emit(char type, int id, long size)
+{
+    if (nreqs == max_reqs) {
+        max_reqs = max_reqs ? 2 * max_reqs : 1024;
+        reqs = xrealloc(reqs, max_reqs * sizeof(req_t));
+    }
+    reqs[nreqs].type = type;
+    reqs[nreqs].id = id;
+    reqs[nreqs].size = size;
+    nreqs++;
+}
+
+/* free_first - Free the live block that is due soonest */
+static void free_first(void)
+{
+    int id = heap[0];
+
+    emit('f', id, 0);
+    live_bytes -= size_of[id];
+    heap_swap(0, --nlive);
+    heap_down(0);
+}
+
+/* alloc_block - Allocate a new block */
+static void alloc_block(const spec_t *s)
+{
+    long size = (long)sample(&s->sizes);
+    int id;
+
+    if (size < 1)
+        size = 1;
+    if (size > s->peak)
+        size = (long)s->peak;
+    while (nlive > 0 && live_bytes + size > s->peak)
+        free_first();
+
+    if (nids == max_ids) {
+        max_ids = max_ids ? 2 * max_ids : 1024;
+        size_of = xrealloc(size_of, max_ids * sizeof(long));
+        death = xrealloc(death, max_ids * sizeof(double));
+        heap = xrealloc(heap, max_ids * sizeof(int));
+    }
+    id = nids++;
+    size_of[id] = size;
+    death[id] = nreqs + 1 + lifetime(&s->lifetime);
+    heap[nlive] = id;
+    heap_up(nlive++);
+    live_bytes += size;
+    emit('a', id, size);
+}
+
+/* realloc_block - Grow a random live block */
+static void realloc_block(const spec_t *s)
+{
+    int id = heap[(int)(urand() * nlive)];
+    long size = (long)(size_of[id] * s->growth + 0.5);
+
+    if (size <= size_of[id])
+        size = size_of[id] + 1;
+    if (live_bytes - size_of[id] + size > s->peak) {
+        alloc_block(s);     /* no room to grow it; allocate instead */
+        return;
+    }
+    live_bytes += size - size_of[id];
+    size_of[id] = size;
+    emit('r', id, size);
+}
+
+/* generate - Generate the trace for spec s */
+static void generate(const spec_t *s)
+{
+    rng_state = s->seed * 2654435761ULL + 1;
+
+    while (nreqs + nlive < s->ops) {
+        if (nlive > 0 && death[heap[0]] <= nreqs)
+            free_first();
+        else if (nlive > 0 && urand() < s->realloc_p)
+            realloc_block(s);
+        else
+            alloc_block(s);
+    }
+    while (nlive > 0)
+        free_first();
+}
+
+/* parse_dist - Parse the arguments of a sizes or lifetime line */
+static void parse_dist(dist_t *d, const char *args, const char *line)
+{
+    char kind[MAXLINE];
+    int n;
+
+    memset(d, 0, sizeof(*d));
+    if (sscanf(args, "%s", kind) != 1)
+        die("bad spec line: %s", line);
+    args += strspn(args, " \t");
+    args += strlen(kind);
+
+    if (!strcmp(kind, "fixed")) {
+        d->kind = D_FIXED;
+        n = sscanf(args, "%lf", &d->a) == 1;
+    } else if (!strcmp(kind, "uniform")) {
+        d->kind = D_UNIFORM;
+        n = sscanf(args, "%lf %lf", &d->a, &d->b) == 2 && d->a <= d->b;
+    } else if (!strcmp(kind, "powerlaw")) {
+        d->kind = D_POWERLAW;
+        n = sscanf(args, "%lf %lf %lf", &d->a, &d->b, &d->c) == 3 &&
+            d->a > 0 && d->a <= d->b;
+    } else if (!strcmp(kind, "bimodal")) {
+        d->kind = D_BIMODAL;
+        /* sizes: two ranges and p; lifetimes: two means and p */
+        n = sscanf(args, "%lf %lf %lf %lf %lf",
+                   &d->a, &d->b, &d->c, &d->d, &d->p);
+        if (n == 3) {
+            d->p = d->c;
+            n = 1;
+        } else {
+            n = (n == 5);
+        }
+    } else if (!strcmp(kind, "exp")) {
+        d->kind = D_EXP;
+        n = sscanf(args, "%lf", &d->a) == 1 && d->a > 0;
+    } else {
+        n = 0;
+    }
+    if (!n)
+        die("bad distribution: %s", line);
+}
+
+/* read_spec - Read the spec file into s */
+static void read_spec(spec_t *s, const char *filename)
+{
+    FILE *fp;
+    char line[MAXLINE], key[MAXLINE], *args;
+
+    s->ops = 10000;
+    s->seed = 1;
+    s->peak = 16 << 20;
+    s->weight = 0;
+    parse_dist(&s->sizes, "powerlaw 16 4096 1.5", "default");
+    parse_dist(&s->lifetime, "exp 100", "default");
+    s->realloc_p = 0;
+    s->growth = 1;
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if ((args = strchr(line, '#')) != NULL)
+            *args = '\0';
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%s", key) != 1)
+            continue;
+        args = line + strspn(line, " \t") + strlen(key);
+
+        if (!strcmp(key, "ops")) {
+            if (sscanf(args, "%ld", &s->ops) != 1 || s->ops < 1)
+                die("bad spec line: %s", line);
+        } else if (!strcmp(key, "seed")) {
+            if (sscanf(args, "%lu", &s->seed) != 1)
+                die("bad spec line: %s", line);
+        } else if (!strcmp(key, "peak")) {
+            if (sscanf(args, "%lf", &s->peak) != 1 || s->peak < 1)
+                die("bad spec line: %s", line);
+        } else if (!strcmp(key, "weight")) {
+            if (sscanf(args, "%d", &s->weight) != 1 ||
+                s->weight < 0 || s->weight > 3)
+                die("bad spec line: %s", line);
+        } else if (!strcmp(key, "sizes")) {
+            parse_dist(&s->sizes, args, line);
+            if (s->sizes.kind == D_EXP ||
+                (s->sizes.kind == D_BIMODAL && s->sizes.d == 0))
+                die("bad size distribution: %s", line);
+        } else if (!strcmp(key, "lifetime")) {
+            parse_dist(&s->lifetime, args, line);
+            if (s->lifetime.kind == D_POWERLAW ||
+                (s->lifetime.kind == D_BIMODAL && s->lifetime.d != 0))
+                die("bad lifetime distribution: %s", line);
+        } else if (!strcmp(key, "realloc")) {
+            if (sscanf(args, "%lf %lf", &s->realloc_p, &s->growth) != 2 ||
+                s->realloc_p < 0 || s->realloc_p >= 1 || s->growth < 1)
+                die("bad spec line: %s", line);
+        } else {
+            die("unknown spec key: %s", key);
+        }
+    }
+    fclose(fp);
+}
+
+/* write_trace - Write the generated trace in .rep format */
+static void write_trace(const spec_t *s, FILE *fp)
+{
+    long i;
+
+    fprintf(fp, "%d\n%d\n%ld\n%d\n", s->weight, nids, nreqs, 0);
+    for (i = 0; i < nreqs; i++) {
+        if (reqs[i].type == 'f')
+            fprintf(fp, "f %d\n", reqs[i].id);
+        else
+            fprintf(fp, "%c %d %ld\n", reqs[i].type, reqs[i].id, reqs[i].size);
+    }
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-h] [-s <seed>] [-o <file>] <spec>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-s <seed>  Override the seed in the spec.\n");
+    fprintf(stderr, "\t-o <file>  Write the trace to <file> (default stdout).\n");
+}
+
+int main(int argc, char **argv)
+{
+    spec_t spec;
+    char *outfile = NULL;
+    char *seed = NULL;
+    FILE *fp = stdout;
+    int c;
+
+    while ((c = getopt(argc, argv, "hs:o:")) != EOF) {
+        switch (c) {
+        case 's':
+            seed = optarg;
+            break;
+        case 'o':
+            outfile = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        exit(1);
+    }
+
+    read_spec(&spec, argv[optind]);
+    if (seed != NULL)
+        spec.seed = strtoul(seed, NULL, 0);
+
+    generate(&spec);
+
+    if (outfile != NULL && (fp = fopen(outfile, "w")) == NULL) {
+        perror(outfile);
+        exit(1);
+    }
+    write_trace(&spec, fp);
+    if (fp != stdout && fclose(fp) != 0) {
+        perror(outfile);
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,423 @@
+/*
+ * trconv.c - Convert traces between the .rep text format and the
+ *     binary format of tracefmt.h
+ *
+ * The direction is picked from the input: a binary trace is written
+ * out as .rep text, anything else is read as .rep and written as a
+ * binary trace. Text traces are converted a request at a time, so
+ * traces larger than memory convert fine.
+ *
+ * An allocation log recorded by libmtrace.so is turned into a .rep
+ * trace (or a binary one, with -b). The calls of all threads are
+ * merged in their global order, and each block returned gets a fresh
+ * id that its later realloc and free calls refer to. Calls mdriver
+ * can't replay are dropped: failed calls, zero-byte allocations, and
+ * frees of blocks allocated before the recording started.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tracefmt.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: trconv [-hb] <infile> <outfile>\n");
+    fprintf(stderr, "Converts a .rep trace to a binary trace, or back, or an\n");
+    fprintf(stderr, "allocation log from libmtrace.so to a .rep trace.\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-b         Write a log out as a binary trace instead.\n");
+}
+
+static void die(const char *filename, const char *msg)
+{
+    fprintf(stderr, "trconv: %s: %s\n", filename, msg);
+    exit(1);
+}
+
+/*
+ * rep_to_bin - Convert a .rep trace to a binary trace
+ */
+static void rep_to_bin(const char *in, const char *out)
+{
+    FILE *fin, *fout;
+    tf_header_t hdr;
+    tf_op_t op;
+    char type[2];
+    int index, max_index = -1, nops = 0;
+    unsigned int size;
+
+    if ((fin = fopen(in, "r")) == NULL) {
+        perror(in);
+        exit(1);
+    }
+    if ((fout = fopen(out, "w")) == NULL) {
+        perror(out);
+        exit(1);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TF_MAGIC, sizeof(hdr.magic));
+    hdr.version = TF_VERSION;
+    hdr.byte_order = TF_BYTE_ORDER;
+    if (fscanf(fin, "%d %d %d %d", &hdr.weight, &hdr.num_ids,
+               &hdr.num_ops, &hdr.ignore_ranges) != 4)
+        die(in, "bad header");
+    fwrite(&hdr, sizeof(hdr), 1, fout);
+
+    while (nops < hdr.num_ops && fscanf(fin, "%1s", type) == 1) {
+        memset(&op, 0, sizeof(op));
+        switch (type[0]) {
+        case 'a':
+        case 'r':
+            if (fscanf(fin, "%d %u", &index, &size) != 2)
+                die(in, "bad request");
+            if (size > TF_MAX_SIZE)
+                die(in, "request size too large for a binary trace");
+            op.type = (type[0] == 'a') ? TF_ALLOC : TF_REALLOC;
+            op.size = size;
+            break;
+        case 'f':
+            if (fscanf(fin, "%d", &index) != 1)
+                die(in, "bad request");
+            op.type = TF_FREE;
+            break;
+        default:
+            die(in, "bogus request type");
+        }
+        if (index < -1 || index >= hdr.num_ids)
+            die(in, "request index out of range");
+        op.index = index;
+        max_index = (index > max_index) ? index : max_index;
+        fwrite(&op, sizeof(op), 1, fout);
+        nops++;
+    }
+    if (nops != hdr.num_ops)
+        die(in, "fewer requests than num_ops");
+    if (max_index != hdr.num_ids - 1)
+        die(in, "num_ids does not match the requests");
+
+    fclose(fin);
+    if (fclose(fout) != 0) {
+        perror(out);
+        exit(1);
+    }
+}
+
+/*
+ * write_trace - Write a trace in memory to out, as .rep text or as a
+ *     binary trace
+ */
+static void write_trace(const char *out, int binary, const tf_header_t *hdr,
+                        const tf_op_t *ops)
+{
+    FILE *fout;
+    int i;
+
+    if ((fout = fopen(out, "w")) == NULL) {
+        perror(out);
+        exit(1);
+    }
+
+    if (binary) {
+        fwrite(hdr, sizeof(*hdr), 1, fout);
+        fwrite(ops, sizeof(*ops), hdr->num_ops, fout);
+    } else {
+        fprintf(fout, "%d\n%d\n%d\n%d\n", hdr->weight, hdr->num_ids,
+                hdr->num_ops, hdr->ignore_ranges);
+        for (i = 0; i < hdr->num_ops; i++) {
+            const tf_op_t *op = &ops[i];
+            switch (op->type) {
+            case TF_ALLOC:
+                fprintf(fout, "a %d %u\n", op->index, (unsigned)op->size);
+                break;
+            case TF_REALLOC:
+                fprintf(fout, "r %d %u\n", op->index, (unsigned)op->size);
+                break;
+            case TF_FREE:
+                fprintf(fout, "f %d\n", op->index);
+                break;
+            }
+        }
+    }
+
+    if (fclose(fout) != 0) {
+        perror(out);
+        exit(1);
+    }
+}
+
+/*
+ * bin_to_rep - Convert a binary trace to a .rep trace
+ */
+static void bin_to_rep(const char *in, const char *out)
+{
+    tf_map_t m;
+    const char *err;
+
+    if ((err = tf_map(&m, in)) != NULL)
+        die(in, err);
+    write_trace(out, 0, m.hdr, m.ops);
+    tf_unmap(&m);
+}
+
+/*
+ * The live blocks of a log being converted: an open-addressing hash
+ * table from address to block id, with backward-shift deletion.
+ */
+static uint64_t *live_ptr;      /* 0 marks an empty slot */
+static int *live_id;
+static size_t live_cap, live_n;
+
+static size_t live_slot(uint64_t ptr)
+{
+    size_t i = (ptr * 0x9e3779b97f4a7c15ULL) >> 20;
+
+    for (i &= live_cap - 1; live_ptr[i] != 0 && live_ptr[i] != ptr;
+         i = (i + 1) & (live_cap - 1))
+        ;
+    return i;
+}
+
+static void live_put(uint64_t ptr, int id);
+
+static void live_grow(void)
+{
+    uint64_t *old_ptr = live_ptr;
+    int *old_id = live_id;
+    size_t i, old_cap = live_cap;
+
+    live_cap = old_cap ? 2 * old_cap : 1024;
+    live_ptr = calloc(live_cap, sizeof(*live_ptr));
+    live_id = calloc(live_cap, sizeof(*live_id));
+    if (live_ptr == NULL || live_id == NULL)
+        die("trconv", "out of memory");
+    live_n = 0;
+    for (i = 0; i < old_cap; i++)
+        if (old_ptr[i] != 0)
+            live_put(old_ptr[i], old_id[i]);
+    free(old_ptr);
+    free(old_id);
+}
+
+static void live_put(uint64_t ptr, int id)
+{
+    size_t i;
+
+    if (2 * (live_n + 1) > live_cap)
+        live_grow();
+    i = live_slot(ptr);
+    if (live_ptr[i] == 0)
+        live_n++;
+    live_ptr[i] = ptr;
+    live_id[i] = id;
+}
+
+/* live_take - Remove ptr and return its id, or -1 if it isn't live */
+static int live_take(uint64_t ptr)
+{
+    size_t i, j, k;
+    int id;
+
+    if (live_cap == 0)
+        return -1;
+    i = live_slot(ptr);
+    if (live_ptr[i] == 0)
+        return -1;
+    id = live_id[i];
+    live_n--;
+
+    /* shift back the entries after it that probed past slot i */
+    for (j = (i + 1) & (live_cap - 1); live_ptr[j] != 0;
+         j = (j + 1) & (live_cap - 1)) {
+        k = ((live_ptr[j] * 0x9e3779b97f4a7c15ULL) >> 20) & (live_cap - 1);
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            live_ptr[i] = live_ptr[j];
+            live_id[i] = live_id[j];
+            i = j;
+        }
+    }
+    live_ptr[i] = 0;
+    return id;
+}
+
+static int event_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const tf_event_t *)a)->seq;
+    uint64_t y = ((const tf_event_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * log_to_trace - Convert an allocation log from libmtrace.so
+ */
+static void log_to_trace(const char *in, const char *out, int binary)
+{
+    FILE *fin;
+    tf_log_header_t lhdr;
+    tf_header_t hdr;
+    tf_event_t *ev = NULL;
+    tf_op_t *ops;
+    size_t nev = 0, cap = 0, i, dropped = 0;
+    int nops = 0, nids = 0, ntids = 0, id;
+
+    if ((fin = fopen(in, "r")) == NULL) {
+        perror(in);
+        exit(1);
+    }
+    if (fread(&lhdr, sizeof(lhdr), 1, fin) != 1 ||
+        memcmp(lhdr.magic, TF_LOG_MAGIC, sizeof(lhdr.magic)) != 0)
+        die(in, "not an allocation log");
+    if (lhdr.byte_order != TF_BYTE_ORDER)
+        die(in, "written with a different byte order");
+    if (lhdr.version != TF_VERSION)
+        die(in, "unsupported version");
+
+    for (;;) {
+        if (nev == cap) {
+            cap = cap ? 2 * cap : 65536;
+            if ((ev = realloc(ev, cap * sizeof(*ev))) == NULL)
+                die(in, "out of memory");
+        }
+        if (fread(&ev[nev], sizeof(*ev), 1, fin) != 1)
+            break;
+        if (ev[nev].tid >= ntids)
+            ntids = ev[nev].tid + 1;
+        nev++;
+    }
+    fclose(fin);
+
+    /* Each thread's events are in order, but the threads' chunks aren't */
+    qsort(ev, nev, sizeof(*ev), event_cmp);
+
+    /* At most two requests per event: a missed free, then the call */
+    if ((ops = calloc(2 * nev + 1, sizeof(*ops))) == NULL)
+        die(in, "out of memory");
+
+    for (i = 0; i < nev; i++) {
+        tf_event_t *e = &ev[i];
+        uint32_t size = e->size > TF_MAX_SIZE ? TF_MAX_SIZE : e->size;
+
+        switch (e->type) {
+        case TF_ALLOC:
+            if (e->ptr == 0 || size == 0) {
+                dropped++;
+                break;
+            }
+            if ((id = live_take(e->ptr)) >= 0) {
+                /* a free we missed; drop the stale block first */
+                ops[nops].type = TF_FREE;
+                ops[nops++].index = id;
+            }
+            ops[nops].type = TF_ALLOC;
+            ops[nops].index = nids;
+            ops[nops++].size = size;
+            live_put(e->ptr, nids++);
+            break;
+
+        case TF_FREE:
+            if ((id = live_take(e->ptr)) < 0) {
+                dropped++;
+                break;
+            }
+            ops[nops].type = TF_FREE;
+            ops[nops++].index = id;
+            break;
+
+        case TF_REALLOC:
+            if (e->ptr == 0 && size != 0) {
+                dropped++;      /* failed; the old block is untouched */
+                break;
+            }
+            id = (e->old == 0) ? -1 : live_take(e->old);
+            if (size == 0) {
+                /* realloc(p, 0) frees p */
+                if (id >= 0) {
+                    ops[nops].type = TF_FREE;
+                    ops[nops++].index = id;
+                } else {
+                    dropped++;
+                }
+                if (e->ptr != 0)
+                    live_take(e->ptr);
+                break;
+            }
+            if (id < 0) {
+                /* realloc(NULL, n), or of a block we never saw */
+                ops[nops].type = TF_ALLOC;
+                id = nids++;
+            } else {
+                ops[nops].type = TF_REALLOC;
+            }
+            ops[nops].index = id;
+            ops[nops++].size = size;
+            live_put(e->ptr, id);
+            break;
+
+        default:
+            die(in, "bogus event type");
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TF_MAGIC, sizeof(hdr.magic));
+    hdr.version = TF_VERSION;
+    hdr.byte_order = TF_BYTE_ORDER;
+    hdr.num_ids = nids;
+    hdr.num_ops = nops;
+    write_trace(out, binary, &hdr, ops);
+
+    fprintf(stderr, "trconv: %s: %zu calls from %d threads, %d requests, "
+            "%d blocks, %zu calls dropped\n", in, nev, ntids, nops, nids,
+            dropped);
+    free(ev);
+    free(ops);
+}
+
+/* is_log - Does filename start with the allocation log magic? */
+static int is_log(const char *filename)
+{
+    char magic[4];
+    FILE *fp;
+    int n;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+        return 0;
+    n = fread(magic, sizeof(magic), 1, fp);
+    fclose(fp);
+    return n == 1 && memcmp(magic, TF_LOG_MAGIC, sizeof(magic)) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int c, binary = 0;
+
+    while ((c = getopt(argc, argv, "hb")) != EOF) {
+        switch (c) {
+        case 'b':
+            binary = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 2) {
+        usage();
+        exit(1);
+    }
+
+    if (is_log(argv[optind]))
+        log_to_trace(argv[optind], argv[optind + 1], binary);
+    else if (tf_is_binary(argv[optind]))
+        bin_to_rep(argv[optind], argv[optind + 1]);
+    else
+        rep_to_bin(argv[optind], argv[optind + 1]);
+    return 0;
+}